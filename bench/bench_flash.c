@@ -0,0 +1,247 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+/* End to end flashing benchmark. Parses each hex file, programs it into
+ * a simulated HalfKay device (source/dev-sim.c) with program_resume(),
+ * boots it and checks the device's flash against the image. Synthetic
+ * images filling the whole flash of several MCUs run after the files,
+ * then one of them again with faults injected part way, which have to
+ * be retried or resumed, or fail cleanly.
+ *
+ * Usage: bench_flash [-s speed] [[mcu=]file.hex ...]
+ *
+ * Without mcu= the MCU comes from the end of the file name, so
+ * blink_slow_Teensy40.hex runs as TEENSY40. speed scales the modeled
+ * erase and write delays, the default 0 only adds them up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dev-sim.h"
+#include "dev.h"
+#include "ihex.h"
+#include "image.h"
+#include "misc.h"
+#include "param.h"
+#include "program.h"
+
+// full size images, one per MCU family
+static const char* synthetic_mcus[] = {"TEENSY2", "TEENSY2PP", "TEENSYLC", "TEENSY32", "TEENSY36", "TEENSY41"};
+
+// injected after FAULT_BLOCKS blocks of the FAULT_MCU image
+struct fault_case {
+	const char*    name;
+	enum sim_fault fault;
+	int            count;
+	int            ok; // programming still succeeds
+};
+
+#define FAULT_MCU    "TEENSY32"
+#define FAULT_BLOCKS 16
+
+static const struct fault_case fault_cases[] = {
+	{"fault: 3 stalls", SIM_STALL, 3, 1},
+	{"fault: dropped, resumed", SIM_DROP, 1, 1},
+	{"fault: new path, resumed", SIM_REENUMERATE, 1, 1}, // found by serial
+	{"fault: dropped 4 times", SIM_DROP, 4, 0}, // more than program_resume() allows
+	{"fault: unplugged", SIM_UNPLUG, 1, 0},
+};
+
+static double speed      = 0.0;
+static double total_cpu  = 0.0;
+static double total_wall = 0.0;
+static int    failures   = 0;
+
+static double cpu_time(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static char* write_record(char* p, int len, int addr, int code, const unsigned char* data)
+{
+	int sum, i;
+
+	sum = len + ((addr >> 8) & 255) + (addr & 255) + code;
+	p += sprintf(p, ":%02X%04X%02X", len, addr & 0xFFFF, code);
+	for (i = 0; i < len; i++) {
+		p += sprintf(p, "%02X", data[i]);
+		sum += data[i];
+	}
+	return p + sprintf(p, "%02X\n", (-sum) & 255);
+}
+
+// random data over all of the flash, in 16 byte records. Teensy 4 files
+// are based at the 0x60000000 FlexSPI window, like the toolchain's
+static char* synthetic_hex(int size, int block_size, size_t* length)
+{
+	unsigned char data[16];
+	unsigned int  addr, base, seed = 1;
+	char *        hex, *p;
+	int           i;
+
+	base = size > 1048576 && block_size >= 1024 ? 0x6000 : 0;
+	hex  = (char*)malloc((size_t)size / 16 * 44 + (size_t)size / 65536 * 16 + 64);
+	if (!hex)
+		return NULL;
+	p = hex;
+	for (addr = 0; addr < (unsigned int)size; addr += 16) {
+		if ((addr & 0xFFFF) == 0) {
+			data[0] = (unsigned char)((base + (addr >> 16)) >> 8);
+			data[1] = (unsigned char)((base + (addr >> 16)) & 255);
+			p       = write_record(p, 2, 0, 4, data);
+		}
+		for (i = 0; i < 16; i++) {
+			seed    = seed * 1103515245 + 12345;
+			data[i] = (unsigned char)(seed >> 16);
+		}
+		p = write_record(p, 16, addr & 0xFFFF, 0, data);
+	}
+	p       = write_record(p, 0, 0, 1, data);
+	*length = p - hex;
+	return hex;
+}
+
+// compares every block of the simulated flash with the image
+static int check_flash(const struct image* img)
+{
+	const unsigned char* flash = sim_flash(0);
+	unsigned char        buf[1024];
+	int                  addr;
+
+	for (addr = 0; addr < code_size; addr += block_size) {
+		image_get_data(img, addr, block_size, buf);
+		if (memcmp(flash + addr, buf, block_size) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+// parses the hex file at path, or data if path is NULL, then flashes
+// and checks it. With a fault, ok tells if it failed as expected
+static void run(const char* name, const char* mcu, const char* path, const char* data, size_t size, const struct fault_case* fault)
+{
+	struct program_target target;
+	struct teensy_device* dev;
+	struct teensy_info    info;
+	double                wall, cpu, parse;
+	int                   bytes, blocks = -1, ok = 0;
+
+	if (!find_mcu(mcu, &code_size, &block_size)) {
+		printf("%-28s unknown MCU \"%s\"\n", name, mcu);
+		failures++;
+		return;
+	}
+	wall  = monotonic_time();
+	cpu   = cpu_time();
+	bytes = path ? read_intel_hex(path) : read_intel_hex_data(NULL, data, size);
+	parse = monotonic_time() - wall;
+	if (bytes > 0) {
+		sim_setup(1, code_size, block_size, speed);
+		if (fault)
+			sim_fault(0, FAULT_BLOCKS, fault->fault, fault->count);
+		teensy_list(&info, 1);
+		dev    = teensy_open_device(&info);
+		target = (struct program_target){
+			.img        = ihex_image(),
+			.code_size  = code_size,
+			.block_size = block_size,
+		};
+		blocks = program_resume(&dev, &info, &target, 0);
+		ok     = blocks >= 0 && boot_block_size(dev, block_size) && sim_booted(0);
+		if (dev)
+			teensy_close_device(dev);
+	}
+	wall = monotonic_time() - wall;
+	cpu  = cpu_time() - cpu;
+	if (ok)
+		ok = check_flash(ihex_image()) && sim_errors(0) == 0;
+	if (fault && !fault->ok)
+		ok = blocks < 0 && sim_errors(0) == 0;
+	printf("%-28s %-10s %7d %6d %9.1f %9.1f %9.1f %9.2f  %s\n", name, mcu, bytes / 1024, blocks, parse * 1000.0, wall * 1000.0, cpu * 1000.0, sim_device_time(0), ok ? "ok" : "FAILED");
+	total_wall += wall;
+	total_cpu += cpu;
+	if (!ok)
+		failures++;
+}
+
+// blink_slow_Teensy40.hex -> Teensy40, the MicroMod files are
+// named TeensyMM
+static void mcu_from_name(const char* path, char* mcu, int size)
+{
+	const char *begin, *end;
+
+	begin = strrchr(path, '_');
+	begin = begin ? begin + 1 : path;
+	end   = strrchr(begin, '.');
+	if (!end)
+		end = begin + strlen(begin);
+	snprintf(mcu, size, "%.*s", (int)(end - begin), begin);
+	if (strcmp(mcu, "TeensyMM") == 0)
+		snprintf(mcu, size, "TEENSY_MICROMOD");
+}
+
+int main(int argc, char** argv)
+{
+	const char *path, *name;
+	char        mcu[32];
+	char*       hex;
+	size_t      length;
+	int         i, arg = 1;
+
+	if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+		speed = atof(argv[2]);
+		arg   = 3;
+	}
+	if (speed < 0.0) {
+		fprintf(stderr, "Usage: bench_flash [-s speed] [[mcu=]file.hex ...]\n");
+		return 1;
+	}
+	printf("%-28s %-10s %7s %6s %9s %9s %9s %9s  %s\n", "image", "mcu", "KB", "blocks", "parse ms", "wall ms", "cpu ms", "device s", "check");
+	for (; arg < argc; arg++) {
+		path = strchr(argv[arg], '=');
+		if (path) {
+			snprintf(mcu, sizeof(mcu), "%.*s", (int)(path - argv[arg]), argv[arg]);
+			path++;
+		} else {
+			path = argv[arg];
+			mcu_from_name(path, mcu, sizeof(mcu));
+		}
+		name = strrchr(path, '/');
+		run(name ? name + 1 : path, mcu, path, NULL, 0, NULL);
+	}
+	for (i = 0; i < (int)(sizeof(synthetic_mcus) / sizeof(synthetic_mcus[0])); i++) {
+		if (!find_mcu(synthetic_mcus[i], &code_size, &block_size))
+			continue;
+		hex = synthetic_hex(code_size, block_size, &length);
+		if (!hex) {
+			fprintf(stderr, "Unable to allocate the synthetic image\n");
+			return 1;
+		}
+		run("synthetic (full flash)", synthetic_mcus[i], NULL, hex, length, NULL);
+		free(hex);
+	}
+	if (find_mcu(FAULT_MCU, &code_size, &block_size) && (hex = synthetic_hex(code_size, block_size, &length)) != NULL) {
+		for (i = 0; i < (int)(sizeof(fault_cases) / sizeof(fault_cases[0])); i++)
+			run(fault_cases[i].name, FAULT_MCU, NULL, hex, length, &fault_cases[i]);
+		free(hex);
+	}
+	printf("total: %.1f ms wall, %.1f ms cpu, %d failed\n", total_wall * 1000.0, total_cpu * 1000.0, failures);
+	return failures ? 1 : 0;
+}
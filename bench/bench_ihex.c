@@ -0,0 +1,225 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+/* Intel HEX parser benchmark. Writes a synthetic Teensy 4.x image and
+ * times read_intel_hex() against the old sscanf based line decoder,
+ * then shows how the parser scales with the number of threads.
+ *
+ * Usage: bench_ihex [megabytes] [iterations] [file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ihex.h"
+#include "param.h"
+#include "thread.h"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void write_record(FILE* fp, int len, int addr, int code, const unsigned char* data)
+{
+	int sum, i;
+
+	sum = len + ((addr >> 8) & 255) + (addr & 255) + code;
+	fprintf(fp, ":%02X%04X%02X", len, addr & 0xFFFF, code);
+	for (i = 0; i < len; i++) {
+		fprintf(fp, "%02X", data[i]);
+		sum += data[i];
+	}
+	fprintf(fp, "%02X\n", (-sum) & 255);
+}
+
+// same layout as the Teensy 4 toolchain output: 16 byte records
+// based at the 0x60000000 FlexSPI window
+static int write_image(const char* path, int size)
+{
+	unsigned char data[16];
+	FILE*         fp;
+	unsigned int  addr, seed = 1;
+	int           i;
+
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return 0;
+	for (addr = 0; addr < (unsigned int)size; addr += 16) {
+		if ((addr & 0xFFFF) == 0) {
+			data[0] = (unsigned char)((0x6000 + (addr >> 16)) >> 8);
+			data[1] = (unsigned char)((0x6000 + (addr >> 16)) & 255);
+			write_record(fp, 2, 0, 4, data);
+		}
+		for (i = 0; i < 16; i++) {
+			seed    = seed * 1103515245 + 12345;
+			data[i] = (unsigned char)(seed >> 16);
+		}
+		write_record(fp, 16, addr & 0xFFFF, 0, data);
+	}
+	write_record(fp, 0, 0, 1, data);
+	fclose(fp);
+	return 1;
+}
+
+/* the decoder read_intel_hex() used before the table driven one, */
+/* kept here as the baseline to compare against */
+
+static unsigned char legacy_image[0x1000000];
+static unsigned int  legacy_extended_addr;
+
+static int legacy_parse_hex_line(char* line)
+{
+	int   addr, code, num = 0;
+	int   sum, len, cksum, i;
+	char* ptr;
+
+	if (line[0] != ':')
+		return 0;
+	if (strlen(line) < 11)
+		return 0;
+	ptr = line + 1;
+	if (!sscanf(ptr, "%02x", &len))
+		return 0;
+	ptr += 2;
+	if ((int)strlen(line) < (11 + (len * 2)))
+		return 0;
+	if (!sscanf(ptr, "%04x", &addr))
+		return 0;
+	ptr += 4;
+	if (!sscanf(ptr, "%02x", &code))
+		return 0;
+	ptr += 2;
+	sum = (len & 255) + ((addr >> 8) & 255) + (addr & 255) + (code & 255);
+	if (code == 4 && len == 2) {
+		if (!sscanf(ptr, "%04x", &i))
+			return 1;
+		legacy_extended_addr = ((unsigned int)i << 16) & 0xFFFFFF;
+		return 1;
+	}
+	if (code != 0)
+		return 1;
+	while (num != len) {
+		if (sscanf(ptr, "%02x", &i) != 1)
+			return 0;
+		legacy_image[(addr + legacy_extended_addr + num) & 0xFFFFFF] = i & 255;
+		ptr += 2;
+		sum += i & 255;
+		num++;
+	}
+	if (!sscanf(ptr, "%02x", &cksum))
+		return 0;
+	if (((sum & 255) + (cksum & 255)) & 255)
+		return 0;
+	return 1;
+}
+
+static int legacy_read_intel_hex(const char* path)
+{
+	FILE* fp;
+	char  buf[1024];
+
+	legacy_extended_addr = 0;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (!legacy_parse_hex_line(buf)) {
+			fclose(fp);
+			return -2;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	const char* path       = "bench_ihex.hex";
+	int         megabytes  = 8;
+	int         iterations = 5;
+	double      start, legacy = 0.0, table = 0.0, single = 0.0, elapsed;
+	int         i, size, threads;
+
+	if (argc > 1)
+		megabytes = atoi(argv[1]);
+	if (argc > 2)
+		iterations = atoi(argv[2]);
+	if (argc > 3)
+		path = argv[3];
+	if (megabytes < 1 || megabytes > 255 || iterations < 1) {
+		fprintf(stderr, "Usage: bench_ihex [megabytes (1-255)] [iterations] [file]\n");
+		return 1;
+	}
+	// the largest flash, so every address of the image is in range
+	code_size     = 16515072;
+	block_size    = 1024;
+	parse_threads = 1;
+	size          = megabytes * 1024 * 1024;
+	if (!write_image(path, size)) {
+		fprintf(stderr, "Unable to write \"%s\"\n", path);
+		return 1;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		start = now();
+		if (legacy_read_intel_hex(path) < 0) {
+			fprintf(stderr, "legacy decoder failed\n");
+			return 1;
+		}
+		legacy += now() - start;
+
+		start = now();
+		if (read_intel_hex(path) != size) {
+			fprintf(stderr, "read_intel_hex failed\n");
+			return 1;
+		}
+		table += now() - start;
+	}
+
+	legacy /= iterations;
+	table /= iterations;
+	printf("image: %d MB, %d iterations\n", megabytes, iterations);
+	printf("sscanf decoder: %8.1f ms  %7.1f MB/s\n", legacy * 1000.0, megabytes / legacy);
+	printf("table decoder:  %8.1f ms  %7.1f MB/s\n", table * 1000.0, megabytes / table);
+	printf("speedup:        %8.2fx\n", legacy / table);
+
+	printf("\nthreads  time (ms)     MB/s  scaling\n");
+	for (threads = 1; threads <= thread_cpu_count() * 2; threads *= 2) {
+		parse_threads = threads;
+		elapsed       = 0.0;
+		for (i = 0; i < iterations; i++) {
+			start = now();
+			if (read_intel_hex(path) != size) {
+				fprintf(stderr, "read_intel_hex failed\n");
+				return 1;
+			}
+			elapsed += now() - start;
+		}
+		elapsed /= iterations;
+		if (threads == 1)
+			single = elapsed;
+		printf("%7d  %9.1f  %7.1f  %6.2fx\n", threads, elapsed * 1000.0, megabytes / elapsed, single / elapsed);
+	}
+	remove(path);
+	return 0;
+}
@@ -0,0 +1,260 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+/* Virtual HalfKay devices through the Linux uhid driver. Creates HID
+ * devices with HalfKay's 16C0:0478 ID and report size, so the loader's
+ * hidraw backend finds, opens and writes to them through the kernel
+ * like a real board. Each report goes to a simulated device
+ * (source/dev-sim.c), which checks it, models the erase and write time
+ * and keeps the flash. A device goes away once it is booted.
+ *
+ * Usage: uhid_halfkay [-n devices] [-s speed] [-d delay_ms] [-f fail_rate]
+ *                     [-o prefix] mcu
+ *
+ * -s scales the modeled delays (default 1), -d adds a fixed delay to
+ * every report and -f fails that fraction of them. When every device
+ * has booted, each flash is written to <prefix>N.bin if -o is given.
+ *
+ * uhid passes plain output reports on without waiting, so delays and
+ * failures only reach the loader for SET_REPORT requests, which is how
+ * a real HalfKay is written to. Loading usbhid with
+ * quirks=0x16c0:0x0478:0x40000 (HID_QUIRK_NO_OUTPUT_REPORTS_ON_INTR_EP)
+ * makes hidraw use SET_REPORT for these devices too. Needs write
+ * access to /dev/uhid, usually root.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uhid.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dev-sim.h"
+#include "dev.h"
+#include "ihex.h"
+#include "misc.h"
+#include "param.h"
+#include "program.h"
+#include "thread.h"
+
+#define MAX_UHID_DEVICES 16
+
+struct uhid_device {
+	int                   index;
+	int                   fd;
+	struct teensy_device* sim;
+	struct thread*        thread;
+	int                   reports;
+	int                   failed;
+	unsigned int          seed;
+};
+
+static double extra_delay = 0.0;
+static double fail_rate   = 0.0;
+
+static int send_event(int fd, struct uhid_event* ev)
+{
+	return write(fd, ev, sizeof(*ev)) == sizeof(*ev);
+}
+
+// a vendor defined collection with one output report of write_size
+// bytes and no report ID, like HalfKay's
+static int report_descriptor(unsigned char* rd, int write_size)
+{
+	static const unsigned char head[] = {
+		0x06, 0x9C, 0xFF, // Usage Page (Vendor 0xFF9C)
+		0x09, 0x21,       // Usage (0x21)
+		0xA1, 0x01,       // Collection (Application)
+		0x15, 0x00,       //   Logical Minimum (0)
+		0x26, 0xFF, 0x00, //   Logical Maximum (255)
+		0x75, 0x08,       //   Report Size (8)
+	};
+	int n = sizeof(head);
+
+	memcpy(rd, head, n);
+	rd[n++] = 0x96; // Report Count, two bytes
+	rd[n++] = write_size & 255;
+	rd[n++] = (write_size >> 8) & 255;
+	rd[n++] = 0x09; // Usage (0x22)
+	rd[n++] = 0x22;
+	rd[n++] = 0x91; // Output (Data, Var, Abs)
+	rd[n++] = 0x02;
+	rd[n++] = 0xC0; // End Collection
+	return n;
+}
+
+static int create_device(struct uhid_device* dev, int write_size)
+{
+	struct uhid_event ev;
+
+	dev->fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (dev->fd < 0)
+		return 0;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	snprintf((char*)ev.u.create2.name, sizeof(ev.u.create2.name), "HalfKay (uhid %d)", dev->index);
+	snprintf((char*)ev.u.create2.phys, sizeof(ev.u.create2.phys), "uhid-halfkay/%d", dev->index);
+	snprintf((char*)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%08X", 100000 + dev->index);
+	ev.u.create2.rd_size = report_descriptor(ev.u.create2.rd_data, write_size);
+	ev.u.create2.bus     = 0x03; // BUS_USB, so usbhid quirks apply
+	ev.u.create2.vendor  = 0x16C0;
+	ev.u.create2.product = 0x0478;
+	if (!send_event(dev->fd, &ev)) {
+		close(dev->fd);
+		return 0;
+	}
+	return 1;
+}
+
+// hands a report to the simulated device, returns 0 if it wasn't
+// accepted. hidraw puts report ID 0 in front, which HalfKay doesn't see
+static int handle_report(struct uhid_device* dev, unsigned char* data, int size)
+{
+	int write_size = program_write_size(block_size);
+
+	dev->reports++;
+	if (size == write_size + 1 && data[0] == 0) {
+		data++;
+		size--;
+	}
+	if (extra_delay > 0.0)
+		delay(extra_delay);
+	dev->seed = dev->seed * 1103515245 + 12345;
+	if (fail_rate > 0.0 && (double)((dev->seed >> 16) & 0x7FFF) / 32768.0 < fail_rate) {
+		dev->failed++;
+		return 0;
+	}
+	return teensy_write_device(dev->sim, data, size, 45.0);
+}
+
+static void device_thread(void* arg)
+{
+	struct uhid_device* dev = (struct uhid_device*)arg;
+	struct uhid_event   ev, reply;
+
+	while (!sim_booted(dev->index)) {
+		if (read(dev->fd, &ev, sizeof(ev)) <= 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		memset(&reply, 0, sizeof(reply));
+		switch (ev.type) {
+		case UHID_OUTPUT:
+			handle_report(dev, ev.u.output.data, ev.u.output.size);
+			break;
+		case UHID_SET_REPORT:
+			reply.type                   = UHID_SET_REPORT_REPLY;
+			reply.u.set_report_reply.id  = ev.u.set_report.id;
+			reply.u.set_report_reply.err = handle_report(dev, ev.u.set_report.data, ev.u.set_report.size) ? 0 : EIO;
+			send_event(dev->fd, &reply);
+			break;
+		case UHID_GET_REPORT:
+			reply.type                   = UHID_GET_REPORT_REPLY;
+			reply.u.get_report_reply.id  = ev.u.get_report.id;
+			reply.u.get_report_reply.err = EIO; // HalfKay has nothing to read
+			send_event(dev->fd, &reply);
+			break;
+		default:
+			break;
+		}
+	}
+	// booted into the user's code, HalfKay leaves the bus
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_DESTROY;
+	send_event(dev->fd, &ev);
+	close(dev->fd);
+}
+
+static int write_flash(const char* prefix, int index)
+{
+	char  path[4096];
+	FILE* fp;
+	int   ok;
+
+	snprintf(path, sizeof(path), "%s%d.bin", prefix, index);
+	fp = fopen(path, "wb");
+	if (!fp)
+		return 0;
+	ok = fwrite(sim_flash(index), 1, code_size, fp) == (size_t)code_size;
+	return fclose(fp) == 0 && ok;
+}
+
+static void usage_exit(void)
+{
+	fprintf(stderr, "Usage: uhid_halfkay [-n devices] [-s speed] [-d delay_ms] [-f fail_rate] [-o prefix] mcu\n");
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	struct uhid_device devices[MAX_UHID_DEVICES];
+	const char*        prefix = NULL;
+	const char*        mcu    = NULL;
+	double             speed  = 1.0;
+	int                i, count = 1, failed = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') {
+			mcu = argv[i];
+			continue;
+		}
+		if (i + 1 >= argc)
+			usage_exit();
+		if (strcmp(argv[i], "-n") == 0)
+			count = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0)
+			speed = atof(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0)
+			extra_delay = atof(argv[++i]) / 1000.0;
+		else if (strcmp(argv[i], "-f") == 0)
+			fail_rate = atof(argv[++i]);
+		else if (strcmp(argv[i], "-o") == 0)
+			prefix = argv[++i];
+		else
+			usage_exit();
+	}
+	if (!mcu || count < 1 || count > MAX_UHID_DEVICES || speed < 0.0)
+		usage_exit();
+	if (!find_mcu(mcu, &code_size, &block_size))
+		die("Unknown MCU type \"%s\"\n", mcu);
+
+	sim_setup(count, code_size, block_size, speed);
+	for (i = 0; i < count; i++) {
+		memset(&devices[i], 0, sizeof(devices[i]));
+		devices[i].index = i;
+		devices[i].seed  = i + 1;
+		devices[i].sim   = teensy_open_device(NULL);
+		if (!create_device(&devices[i], program_write_size(block_size)))
+			die("Unable to create a uhid device: %s\n", strerror(errno));
+	}
+	printf("%d virtual HalfKay %s ready\n", count, count == 1 ? "device is" : "devices are");
+	fflush(stdout);
+	for (i = 0; i < count; i++)
+		devices[i].thread = thread_start(device_thread, &devices[i]);
+	for (i = 0; i < count; i++) {
+		thread_join(devices[i].thread);
+		printf("device %d: %d reports, %d blocks, %d rejected, %d failed on purpose, %.2f s modeled, %s\n", i, devices[i].reports, sim_blocks(i), sim_errors(i), devices[i].failed, sim_device_time(i), sim_booted(i) ? "booted" : "not booted");
+		if (!sim_booted(i))
+			failed++;
+		if (prefix && !write_flash(prefix, i))
+			die("Unable to write the flash of device %d\n", i);
+	}
+	return failed ? 1 : 0;
+}
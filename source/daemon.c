@@ -0,0 +1,729 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "daemon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "misc.h"
+
+#if !defined(WIN32)
+
+/****************************************************************/
+/*                                                              */
+/*                  Daemon - Unix Socket Jobs                   */
+/*                                                              */
+/*  Every connection carries one job, sent as a single line of  */
+/*  space separated words, file= must come last:                */
+/*    flash code_size=<n> block_size=<n> [port=<path>]          */
+/*          [serial=<sn>] [wait=1] [reboot=0] [hard=1] [soft=1] */
+/*          [base=<addr>] file=<absolute path>                  */
+/*    boot code_size=<n> block_size=<n> [port=...] [wait=1]     */
+/*    reboot [hard=1] [soft=1] [port=...] [serial=...]          */
+/*    status                                                    */
+/*  and answered with one line, "ok <message>" or               */
+/*  "error <message>". The main thread keeps a list of the      */
+/*  attached HalfKay devices and answers status right away.     */
+/*  Other jobs run one at a time on a worker thread, in the     */
+/*  order they came in, and open the listed device they select  */
+/*  instead of searching for it again. A job whose client hung  */
+/*  up is cancelled while it waits for its device.              */
+/*                                                              */
+/****************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "dev.h"
+#include "hotplug.h"
+#include "ihex.h"
+#include "image.h"
+#include "mapfile.h"
+#include "param.h"
+#include "program.h"
+#include "stats.h"
+
+#define MAX_REQUEST 8192
+#define CACHE_SIZE  8
+#define MAX_TRACKED 16
+#define MAX_JOBS    16  // queued or running at the same time
+#define RESCAN_TIME 1.0 // without hotplug events, list devices this often
+
+// a parsed image, found again by the hash of its file and the MCU and
+// binary base address it was parsed for
+struct cached_image {
+	uint64_t     hash;
+	size_t       size;
+	int          code_size;
+	int          block_size;
+	unsigned     base_address;
+	int          bytes;
+	unsigned int used; // job that last used it, 0 if the entry is free
+	struct image img;
+};
+
+struct job {
+	const char* command;
+	const char* port;
+	const char* serial;
+	const char* file;
+	int         code_size;
+	int         block_size;
+	int         wait;
+	int         reboot;
+	int         hard;
+	int         soft;
+	unsigned    base;
+};
+
+// a connection from accepting it to the reply. The main thread owns
+// the client socket, the worker runs the job
+enum slot_state {
+	SLOT_FREE,
+	SLOT_QUEUED,
+	SLOT_RUNNING,
+	SLOT_DONE,
+};
+
+struct slot {
+	enum slot_state state;
+	int             client;
+	int             cancelled; // the client hung up
+	unsigned int    order;     // jobs run in the order they came in
+	struct job      job;       // points into request
+	char            request[MAX_REQUEST];
+	char            reply[1024];
+};
+
+static struct cached_image cache[CACHE_SIZE];
+static unsigned int        job_number = 0;
+static int                 hotplug    = 0;
+static struct slot         slots[MAX_JOBS];
+static unsigned int        arrivals = 0;
+static int                 wake[2]; // the worker tells the main thread a job is done
+
+// guard the slots and the attached devices
+static pthread_mutex_t jobs_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  jobs_changed = PTHREAD_COND_INITIALIZER;
+#define lock()   pthread_mutex_lock(&jobs_lock)
+#define unlock() pthread_mutex_unlock(&jobs_lock)
+
+static struct teensy_info attached[MAX_TRACKED];
+static int                attached_count = 0;
+
+// splits a request line into a job, returns 0 if it isn't valid
+static int parse_job(char* line, struct job* job)
+{
+	char* word;
+	char* next;
+	char* val;
+
+	memset(job, 0, sizeof(*job));
+	job->reboot = 1;
+	line[strcspn(line, "\r\n")] = '\0';
+	for (word = line; *word; word = next) {
+		if (strncmp(word, "file=", 5) == 0) {
+			job->file = word + 5; // the rest of the line, may contain spaces
+			break;
+		}
+		next = word + strcspn(word, " ");
+		if (*next)
+			*next++ = '\0';
+		val = strchr(word, '=');
+		if (!job->command) {
+			job->command = word;
+			continue;
+		}
+		if (!val)
+			return 0;
+		*val++ = '\0';
+		if (strcmp(word, "port") == 0)
+			job->port = val;
+		else if (strcmp(word, "serial") == 0)
+			job->serial = val;
+		else if (strcmp(word, "code_size") == 0)
+			job->code_size = atoi(val);
+		else if (strcmp(word, "block_size") == 0)
+			job->block_size = atoi(val);
+		else if (strcmp(word, "wait") == 0)
+			job->wait = atoi(val);
+		else if (strcmp(word, "reboot") == 0)
+			job->reboot = atoi(val);
+		else if (strcmp(word, "hard") == 0)
+			job->hard = atoi(val);
+		else if (strcmp(word, "soft") == 0)
+			job->soft = atoi(val);
+		else if (strcmp(word, "base") == 0)
+			job->base = (unsigned)strtoul(val, NULL, 0);
+		else
+			return 0;
+	}
+	return job->command != NULL;
+}
+
+// returns the parsed image of file, parsing it only if its contents
+// aren't cached yet for this MCU and base address. The least recently
+// used entry is replaced when the cache is full.
+static struct cached_image* load_image(const char* file, char* reply, int size)
+{
+	struct mapped_file   mf;
+	struct cached_image* victim = &cache[0];
+	uint64_t             hash;
+	size_t               file_size;
+	double               begin;
+	int                  i, r;
+
+	if (!map_file(file, &mf)) {
+		snprintf(reply, size, "error reading intel hex file \"%s\"", file);
+		return NULL;
+	}
+	hash      = hash_data(mf.data, mf.size);
+	file_size = mf.size;
+	for (i = 0; i < CACHE_SIZE; i++) {
+		if (cache[i].used && cache[i].hash == hash && cache[i].size == file_size && cache[i].code_size == code_size && cache[i].block_size == block_size && cache[i].base_address == base_address) {
+			unmap_file(&mf);
+			cache[i].used = job_number;
+			printf_verbose("Using cached \"%s\"\n", file);
+			return &cache[i];
+		}
+		if (cache[i].used < victim->used)
+			victim = &cache[i];
+	}
+	begin = stats_begin();
+	r     = read_intel_hex_data(file, mf.data, mf.size);
+	stats_end(STATS_PARSE, begin);
+	unmap_file(&mf);
+	if (r < 0) {
+		snprintf(reply, size, "error reading intel hex file \"%s\"", file);
+		return NULL;
+	}
+	printf_verbose("Read \"%s\": %d bytes, %.1f%% usage\n", file, r, (double)r / (double)code_size * 100.0);
+	image_clear(&victim->img);
+	ihex_swap_image(&victim->img);
+	victim->hash         = hash;
+	victim->size         = file_size;
+	victim->code_size    = code_size;
+	victim->block_size   = block_size;
+	victim->base_address = base_address;
+	victim->bytes        = r;
+	victim->used         = job_number;
+	return victim;
+}
+
+// lists every attached HalfKay device. Only the main thread does, its
+// own selection is always empty, and jobs waiting for a device are
+// woken up.
+static void track_devices(void)
+{
+	struct teensy_info list[MAX_TRACKED];
+	int                count;
+
+	teensy_lock();
+	count = teensy_list(list, MAX_TRACKED);
+	teensy_unlock();
+	lock();
+	memcpy(attached, list, count * sizeof(list[0]));
+	attached_count = count;
+	pthread_cond_broadcast(&jobs_changed);
+	unlock();
+}
+
+static void report_status(char* reply, int size)
+{
+	int i, len;
+
+	lock();
+	len = snprintf(reply, size, "ok %d attached", attached_count);
+	for (i = 0; i < attached_count && len < size; i++) {
+		len += snprintf(reply + len, size - len, "%s %.64s", i ? "," : ":", attached[i].path);
+		if (attached[i].serial[0] && len < size)
+			len += snprintf(reply + len, size - len, " serial=%.32s", attached[i].serial);
+	}
+	unlock();
+}
+
+// finds an attached device the job's port and serial select
+static int find_device(struct teensy_info* info)
+{
+	int i, found = 0;
+
+	lock();
+	for (i = 0; i < attached_count && !found; i++) {
+		if (teensy_port_selected(0x0478, attached[i].path) && teensy_serial_selected(0x0478, attached[i].serial)) {
+			*info = attached[i];
+			found = 1;
+		}
+	}
+	unlock();
+	return found;
+}
+
+// waits until the attached devices are listed again, returns 0 if the
+// client hung up
+static int wait_for_devices(struct slot* slot)
+{
+	struct timespec until;
+	int             r;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += (time_t)RESCAN_TIME;
+	lock();
+	if (!slot->cancelled)
+		pthread_cond_timedwait(&jobs_changed, &jobs_lock, &until);
+	r = !slot->cancelled;
+	unlock();
+	return r;
+}
+
+// opens the selected device, waiting for it if the job asks for that
+static struct teensy_device* open_device(struct slot* slot, struct teensy_info* info)
+{
+	const struct job*     job = &slot->job;
+	struct teensy_device* dev;
+	double                begin;
+	int                   r, rebooted = 0;
+
+	while (1) {
+		if (find_device(info)) {
+			teensy_lock();
+			dev = teensy_open_device(info);
+			teensy_unlock();
+			if (dev)
+				return dev;
+		}
+		if ((job->hard || job->soft) && !rebooted) {
+			begin = stats_begin();
+			teensy_lock();
+			r = job->hard ? hard_reboot() : soft_reboot();
+			teensy_unlock();
+			stats_end(STATS_REBOOT, begin);
+			if (job->hard && !r)
+				return NULL;
+			rebooted = 1;
+			continue;
+		}
+		if (!job->wait && !rebooted)
+			return NULL;
+		if (!wait_for_devices(slot))
+			return NULL;
+	}
+}
+
+static void run_job(struct slot* slot)
+{
+	struct job*           job   = &slot->job;
+	char*                 reply = slot->reply;
+	int                   size  = sizeof(slot->reply);
+	struct cached_image*  entry = NULL;
+	struct program_target target;
+	struct teensy_device* dev;
+	struct teensy_info    info;
+	double                begin = monotonic_time();
+	int                   blocks, r;
+
+	job_number++;
+	teensy_select(job->port, job->serial);
+	if (strcmp(job->command, "reboot") == 0) {
+		teensy_lock();
+		r = job->hard ? hard_reboot() : soft_reboot();
+		teensy_unlock();
+		if (r)
+			snprintf(reply, size, "ok rebooted");
+		else
+			snprintf(reply, size, "error unable to reboot");
+		return;
+	}
+	if (strcmp(job->command, "flash") != 0 && strcmp(job->command, "boot") != 0) {
+		snprintf(reply, size, "error unknown command \"%.64s\"", job->command);
+		return;
+	}
+	if (job->code_size <= 0 || (job->block_size != 128 && job->block_size != 256 && job->block_size != 512 && job->block_size != 1024)) {
+		snprintf(reply, size, "error MCU type must be specified");
+		return;
+	}
+	code_size    = job->code_size;
+	block_size   = job->block_size;
+	base_address = job->base;
+	if (strcmp(job->command, "flash") == 0) {
+		if (!job->file) {
+			snprintf(reply, size, "error filename must be specified");
+			return;
+		}
+		entry = load_image(job->file, reply, size);
+		if (!entry)
+			return;
+	}
+	dev = open_device(slot, &info);
+	if (!dev) {
+		snprintf(reply, size, "error unable to open device");
+		return;
+	}
+	if (entry) {
+		target.img        = &entry->img;
+		target.code_size  = entry->code_size;
+		target.block_size = entry->block_size;
+		target.stream     = 0;
+		blocks            = program_resume(&dev, &info, &target, 0);
+		if (blocks < 0) {
+			if (dev)
+				teensy_close_device(dev);
+			snprintf(reply, size, "error writing to Teensy (%s)", teensy_error_name(teensy_write_error()));
+			return;
+		}
+		if (job->reboot)
+			boot(dev);
+		snprintf(reply, size, "ok programmed %d blocks in %.2f seconds", blocks, monotonic_time() - begin);
+	} else {
+		boot(dev);
+		snprintf(reply, size, "ok booted");
+	}
+	teensy_close_device(dev);
+}
+
+// the queued job that came in first, NULL if there is none
+static struct slot* next_job(void)
+{
+	struct slot* next = NULL;
+	int          i;
+
+	for (i = 0; i < MAX_JOBS; i++) {
+		if (slots[i].state == SLOT_QUEUED && (!next || slots[i].order < next->order))
+			next = &slots[i];
+	}
+	return next;
+}
+
+static void* worker(void* arg)
+{
+	struct slot* slot;
+	char         c = 0;
+
+	(void)arg;
+	while (1) {
+		lock();
+		while ((slot = next_job()) == NULL)
+			pthread_cond_wait(&jobs_changed, &jobs_lock);
+		slot->state = SLOT_RUNNING;
+		unlock();
+		if (slot->cancelled)
+			snprintf(slot->reply, sizeof(slot->reply), "error cancelled");
+		else
+			run_job(slot);
+		lock();
+		slot->state = SLOT_DONE;
+		unlock();
+		while (write(wake[1], &c, 1) < 0 && errno == EINTR)
+			;
+	}
+	return NULL;
+}
+
+// reads one line from fd, returns 0 if the client hung up first
+static int read_line(int fd, char* buf, int size)
+{
+	int len = 0, n;
+
+	while (len < size - 1) {
+		n = read(fd, buf + len, size - 1 - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		len += n;
+		buf[len] = '\0';
+		if (strchr(buf, '\n'))
+			return 1;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const char* buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		buf += n;
+		len -= n;
+	}
+	return 1;
+}
+
+static int socket_address(const char* path, struct sockaddr_un* addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+		return 0;
+	strcpy(addr->sun_path, path);
+	return 1;
+}
+
+// sends the reply and hangs up
+static void answer(int client, char* reply)
+{
+	printf_verbose("%s\n", reply);
+	strcat(reply, "\n");
+	write_all(client, reply, strlen(reply));
+	close(client);
+}
+
+// reads the request of a new connection, answers status and invalid
+// requests right away and queues the rest for the worker
+static void accept_job(int client)
+{
+	struct slot* slot = NULL;
+	char         reply[1024];
+	int          i;
+
+	for (i = 0; i < MAX_JOBS && !slot; i++) {
+		if (slots[i].state == SLOT_FREE)
+			slot = &slots[i];
+	}
+	if (!slot) {
+		snprintf(reply, sizeof(reply), "error too many jobs");
+		answer(client, reply);
+		return;
+	}
+	if (!read_line(client, slot->request, sizeof(slot->request))) {
+		close(client);
+		return;
+	}
+	if (!parse_job(slot->request, &slot->job)) {
+		snprintf(reply, sizeof(reply), "error invalid request");
+		answer(client, reply);
+		return;
+	}
+	if (strcmp(slot->job.command, "status") == 0) {
+		report_status(reply, sizeof(reply));
+		answer(client, reply);
+		return;
+	}
+	lock();
+	slot->client    = client;
+	slot->cancelled = 0;
+	slot->order     = arrivals++;
+	slot->state     = SLOT_QUEUED;
+	pthread_cond_broadcast(&jobs_changed);
+	unlock();
+}
+
+// answers the jobs the worker is done with, returns how many
+static int finish_jobs(void)
+{
+	char c[16];
+	int  i, done = 0;
+
+	while (read(wake[0], c, sizeof(c)) > 0)
+		;
+	for (i = 0; i < MAX_JOBS; i++) {
+		lock();
+		if (slots[i].state != SLOT_DONE) {
+			unlock();
+			continue;
+		}
+		unlock();
+		answer(slots[i].client, slots[i].reply);
+		lock();
+		slots[i].state = SLOT_FREE;
+		unlock();
+		done++;
+	}
+	return done;
+}
+
+// a client that hung up cancels its job, anything else it sends is
+// thrown away. Jobs answered since the poll are left alone
+static void check_client(struct slot* slot)
+{
+	char    buf[256];
+	ssize_t n;
+
+	if (slot->state == SLOT_FREE)
+		return;
+	n = recv(slot->client, buf, sizeof(buf), MSG_DONTWAIT);
+	if (n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)))
+		return;
+	lock();
+	if (slot->state == SLOT_QUEUED || slot->state == SLOT_RUNNING)
+		slot->cancelled = 1;
+	pthread_cond_broadcast(&jobs_changed);
+	unlock();
+}
+
+int daemon_serve(const char* socket_path)
+{
+	struct sockaddr_un addr;
+	struct pollfd      pfd[3 + MAX_JOBS];
+	struct slot*       polled[MAX_JOBS];
+	pthread_t          thread;
+	int                fd, client, r, i, n, count;
+
+	if (!socket_address(socket_path, &addr))
+		die("Socket path \"%s\" is too long\n", socket_path);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		die("Unable to create socket\n");
+	unlink(socket_path); // left behind by an earlier daemon
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+		die("Unable to listen on \"%s\": %s\n", socket_path, strerror(errno));
+	signal(SIGPIPE, SIG_IGN);
+	if (pipe(wake) < 0 || fcntl(wake[0], F_SETFL, O_NONBLOCK) < 0)
+		die("Unable to create pipe\n");
+	hotplug = hotplug_open();
+	printf_verbose("Listening on \"%s\"\n", socket_path);
+	track_devices();
+	if (pthread_create(&thread, NULL, worker, NULL) != 0)
+		die("Unable to start the job thread\n");
+	while (1) {
+		pfd[0].fd     = fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd     = wake[0];
+		pfd[1].events = POLLIN;
+		pfd[2].fd     = hotplug ? hotplug_poll_fd() : -1;
+		pfd[2].events = POLLIN;
+		// clients of jobs that aren't answered yet, to notice hangups
+		count = 0;
+		lock();
+		for (i = 0; i < MAX_JOBS; i++) {
+			if ((slots[i].state == SLOT_QUEUED || slots[i].state == SLOT_RUNNING) && !slots[i].cancelled) {
+				pfd[3 + count].fd     = slots[i].client;
+				pfd[3 + count].events = POLLIN;
+				polled[count++]       = &slots[i];
+			}
+		}
+		unlock();
+		r = poll(pfd, 3 + count, hotplug ? -1 : (int)(RESCAN_TIME * 1000.0));
+		if (r < 0 && errno != EINTR)
+			die("Unable to wait for connections: %s\n", strerror(errno));
+		if (r <= 0) {
+			if (r == 0)
+				track_devices();
+			continue;
+		}
+		n = 0;
+		if ((pfd[1].revents & POLLIN) && finish_jobs())
+			n = 1; // jobs reboot devices
+		if (hotplug && (pfd[2].revents & POLLIN) && hotplug_changed())
+			n = 1;
+		if (n)
+			track_devices();
+		for (i = 0; i < count; i++) {
+			if (pfd[3 + i].revents)
+				check_client(polled[i]);
+		}
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+		client = accept(fd, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			die("Unable to accept connections: %s\n", strerror(errno));
+		}
+		accept_job(client);
+	}
+	return 0;
+}
+
+int daemon_submit(const char* socket_path)
+{
+	struct sockaddr_un addr;
+	char               request[MAX_REQUEST], reply[1024], path[PATH_MAX];
+	const char*        command = NULL;
+	int                fd, len, n;
+
+	if (!socket_address(socket_path, &addr))
+		die("Socket path \"%s\" is too long\n", socket_path);
+	if (input_count > 1)
+		usage("The daemon programs a single file per job");
+	if (filename)
+		command = boot_only ? "boot" : "flash";
+	else if (boot_only)
+		command = "boot";
+	else if (hard_reboot_device || soft_reboot_device)
+		command = "reboot";
+	else
+		command = "status";
+	if ((strcmp(command, "flash") == 0 || strcmp(command, "boot") == 0) && !code_size)
+		usage("MCU type must be specified");
+
+	len = snprintf(request, sizeof(request), "%s code_size=%d block_size=%d wait=%d reboot=%d hard=%d soft=%d", command, code_size, block_size, wait_for_device_to_appear, reboot_after_programming, hard_reboot_device, soft_reboot_device);
+	if (port_selector)
+		len += snprintf(request + len, sizeof(request) - len, " port=%s", port_selector);
+	if (serial_selector)
+		len += snprintf(request + len, sizeof(request) - len, " serial=%s", serial_selector);
+	if (strcmp(command, "flash") == 0) {
+		// the daemon runs in another directory
+		if (!realpath(filename, path))
+			die("error reading intel hex file \"%s\"\n", filename);
+		len += snprintf(request + len, sizeof(request) - len, " base=0x%08X file=%s", base_address, path);
+	}
+	if (len >= (int)sizeof(request) - 1)
+		die("Request is too long\n");
+	strcat(request, "\n");
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+		die("Unable to connect to \"%s\": %s\n", socket_path, strerror(errno));
+	if (!write_all(fd, request, strlen(request)))
+		die("Unable to send the job to \"%s\"\n", socket_path);
+	len = 0;
+	while (len < (int)sizeof(reply) - 1 && (n = read(fd, reply + len, sizeof(reply) - 1 - len)) > 0)
+		len += n;
+	close(fd);
+	reply[len] = '\0';
+	reply[strcspn(reply, "\r\n")] = '\0';
+	if (strncmp(reply, "ok", 2) == 0 && strcmp(command, "status") == 0) {
+		printf("%s\n", reply + 3);
+		return 0;
+	}
+	if (strncmp(reply, "ok", 2) == 0) {
+		printf_verbose("%s\n", reply[2] ? reply + 3 : reply);
+		return 0;
+	}
+	fprintf(stderr, "%s\n", reply[0] ? reply : "no reply from daemon");
+	return 1;
+}
+
+#else
+
+int daemon_serve(const char* socket_path)
+{
+	die("The daemon is not supported on Windows\n");
+	return 1;
+}
+
+int daemon_submit(const char* socket_path)
+{
+	die("The daemon is not supported on Windows\n");
+	return 1;
+}
+
+#endif
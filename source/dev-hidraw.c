@@ -0,0 +1,461 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "dev.h"
+
+/****************************************************************/
+/*                                                              */
+/*                  USB Access - Linux hidraw                   */
+/*                                                              */
+/*  Talks to /dev/hidrawN directly, no libraries needed and no  */
+/*  kernel driver has to be detached. For non-root users the    */
+/*  udev rules from pjrc.com grant access to the hidraw nodes.  */
+/*                                                              */
+/****************************************************************/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "misc.h"
+
+// reads a small sysfs attribute, returns 0 if it doesn't exist
+static int read_sysfs(const char* path, char* buf, int size)
+{
+	int fd, n;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	n = read(fd, buf, size - 1);
+	close(fd);
+	if (n < 0)
+		return 0;
+	buf[n] = '\0';
+	return 1;
+}
+
+// checks the HID_ID line of a hid device uevent, "HID_ID=bus:vid:pid"
+static int hid_id_matches(const char* uevent, int vid, int pid)
+{
+	const char*  p = strstr(uevent, "HID_ID=");
+	unsigned int bus, v, d;
+
+	if (p == NULL || sscanf(p + 7, "%x:%x:%x", &bus, &v, &d) != 3)
+		return 0;
+	return (int)v == vid && (int)d == pid;
+}
+
+// the USB port a sysfs device sits on, "bus-port.port..." like the
+// sysfs USB device names. Returns 0 if it isn't a USB device.
+static int usb_port(const char* link, char* buf, int size)
+{
+	char  real[4096];
+	char* p;
+	char* end;
+
+	if (!realpath(link, real))
+		return 0;
+	// .../usb1/1-1/1-1.2/1-1.2:1.0/0003:16C0:0478.0005
+	while ((p = strrchr(real, '/')) != NULL) {
+		*p  = '\0';
+		end = strchr(p + 1, ':');
+		if (end && strchr(p + 1, '-') && strchr(p + 1, '-') < end) {
+			*end = '\0';
+			snprintf(buf, size, "%s", p + 1);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// reads the serial number of the USB device at sysfs path, which is
+// empty if the device has none
+static void usb_serial(const char* path, char* buf, int size)
+{
+	if (!read_sysfs(path, buf, size))
+		buf[0] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+}
+
+// calls func for every selected hidraw node of a vid/pid device until
+// it returns non-zero, which is then returned. Devices which aren't
+// on USB use the node name as their port.
+static int find_devices(int vid, int pid, int (*func)(const char* name, const char* port, const char* serial, void* arg), void* arg)
+{
+	DIR*           dir;
+	struct dirent* d;
+	char           path[512], uevent[1024], port[256], serial[64];
+	int            r = 0;
+
+	dir = opendir("/sys/class/hidraw");
+	if (!dir)
+		return 0;
+	while (!r && (d = readdir(dir)) != NULL) {
+		if (strncmp(d->d_name, "hidraw", 6) != 0)
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/hidraw/%s/device/uevent", d->d_name);
+		if (!read_sysfs(path, uevent, sizeof(uevent)) || !hid_id_matches(uevent, vid, pid))
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/hidraw/%s/device", d->d_name);
+		if (!usb_port(path, port, sizeof(port)))
+			snprintf(port, sizeof(port), "%s", d->d_name);
+		if (!teensy_port_selected(pid, port))
+			continue;
+		// the hid device's parents are the interface, then the USB device
+		snprintf(path, sizeof(path), "/sys/class/hidraw/%s/device/../../serial", d->d_name);
+		usb_serial(path, serial, sizeof(serial));
+		if (!teensy_serial_selected(pid, serial))
+			continue;
+		r = func(d->d_name, port, serial, arg);
+	}
+	closedir(dir);
+	return r;
+}
+
+struct open_request {
+	const char* path;   // NULL for the first device
+	char*       opened; // gets the port of the device, if not NULL
+	int         fd;
+};
+
+static int open_node(const char* name, const char* port, const char* serial, void* arg)
+{
+	struct open_request* req = arg;
+	char                 path[512];
+
+	(void)serial;
+	if (req->path && strcmp(port, req->path) != 0)
+		return 0;
+	snprintf(path, sizeof(path), "/dev/%s", name);
+	req->fd = open(path, O_RDWR | O_CLOEXEC);
+	if (req->fd < 0) {
+		printf_verbose("Found device but unable to open %s, check permissions\n", path);
+		return 0;
+	}
+	if (req->opened)
+		strcpy(req->opened, port);
+	return 1;
+}
+
+// opens the first vid/pid device, or the one at path if it isn't NULL.
+// The port of the device is stored in opened if it isn't NULL
+static int open_usb_device(int vid, int pid, const char* path, char* opened)
+{
+	struct open_request req = {path, opened, -1};
+
+	find_devices(vid, pid, open_node, &req);
+	return req.fd;
+}
+
+// hidraw wants the report ID in front, HalfKay doesn't use report IDs
+static int write_report(int fd, const void* buf, int len)
+{
+	unsigned char report[2048 + 1];
+
+	if (len + 1 > (int)sizeof(report)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	report[0] = 0;
+	memcpy(report + 1, buf, len);
+	return write(fd, report, len + 1) == len + 1 ? len : -1;
+}
+
+struct list_request {
+	struct teensy_info* list;
+	int                 max;
+	int                 count;
+};
+
+static int list_node(const char* name, const char* port, const char* serial, void* arg)
+{
+	struct list_request* req  = arg;
+	struct teensy_info*  info = &req->list[req->count];
+
+	(void)name;
+	snprintf(info->path, sizeof(info->path), "%s", port);
+	snprintf(info->serial, sizeof(info->serial), "%s", serial);
+	req->count++;
+	return req->count >= req->max;
+}
+
+int teensy_list(struct teensy_info* list, int max)
+{
+	struct list_request req = {list, max, 0};
+
+	if (max > 0)
+		find_devices(0x16C0, 0x0478, list_node, &req);
+	return req.count;
+}
+
+// hidraw can't time out a write: every one is a SET_REPORT which the
+// kernel waits on for up to 5 seconds, O_NONBLOCK or not, and poll()
+// always reports the node writable. So the writes are made by a thread
+// of the device, and a caller whose deadline passes stops waiting for
+// it. The next write waits for the abandoned one to end first, and if
+// it's the same report and it went through, isn't sent again.
+struct teensy_device {
+	int             fd;
+	char            path[256]; // port, to open it again
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  changed;
+	unsigned char   report[2048];
+	int             len;
+	int             pending; // report is still being written
+	int             result;  // of the last write, len or -1
+	int             err;     // errno of the last write
+	int             quit;    // closed, the thread frees the device
+};
+
+static void* writer(void* arg)
+{
+	struct teensy_device* dev = arg;
+	int                   r;
+
+	pthread_mutex_lock(&dev->lock);
+	while (1) {
+		while (!dev->pending && !dev->quit)
+			pthread_cond_wait(&dev->changed, &dev->lock);
+		if (!dev->pending)
+			break;
+		pthread_mutex_unlock(&dev->lock);
+		r = write_report(dev->fd, dev->report, dev->len);
+		pthread_mutex_lock(&dev->lock);
+		dev->result  = r;
+		dev->err     = errno;
+		dev->pending = 0;
+		pthread_cond_broadcast(&dev->changed);
+	}
+	pthread_mutex_unlock(&dev->lock);
+	if (dev->fd >= 0)
+		close(dev->fd);
+	pthread_cond_destroy(&dev->changed);
+	pthread_mutex_destroy(&dev->lock);
+	free(dev);
+	return NULL;
+}
+
+// timeout seconds from now, on the monotonic clock
+static void deadline_after(struct timespec* ts, double timeout)
+{
+	long long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ns          = ts->tv_nsec + (long long)(timeout * 1e9);
+	ts->tv_sec  = ts->tv_sec + (time_t)(ns / 1000000000);
+	ts->tv_nsec = (long)(ns % 1000000000);
+}
+
+// waits for the write in progress, returns 0 if deadline passed first
+static int wait_written(struct teensy_device* dev, const struct timespec* deadline)
+{
+	while (dev->pending) {
+		if (pthread_cond_timedwait(&dev->changed, &dev->lock, deadline) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+static int write_device(struct teensy_device* dev, const void* buf, int len, double timeout)
+{
+	struct timespec deadline;
+	int             r = -1, err = ETIMEDOUT;
+
+	if (len > (int)sizeof(dev->report)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	deadline_after(&deadline, timeout);
+	pthread_mutex_lock(&dev->lock);
+	if (wait_written(dev, &deadline)) {
+		if (dev->result == len && dev->len == len && memcmp(dev->report, buf, len) == 0) {
+			r = len; // the abandoned write of this report went through
+		} else {
+			memcpy(dev->report, buf, len);
+			dev->len     = len;
+			dev->result  = -1;
+			dev->pending = 1;
+			pthread_cond_broadcast(&dev->changed);
+			if (wait_written(dev, &deadline)) {
+				r   = dev->result;
+				err = dev->err;
+			}
+		}
+	}
+	// not sending the same report twice only applies right after a timeout
+	if (r == len)
+		dev->len = 0;
+	pthread_mutex_unlock(&dev->lock);
+	errno = err;
+	return r;
+}
+
+struct teensy_device* teensy_open_device(const struct teensy_info* info)
+{
+	struct teensy_device* dev;
+	pthread_condattr_t    attr;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+	dev->fd = open_usb_device(0x16C0, 0x0478, info ? info->path : NULL, dev->path);
+	if (dev->fd < 0) {
+		free(dev);
+		return NULL;
+	}
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&dev->lock, NULL);
+	pthread_cond_init(&dev->changed, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&dev->thread, NULL, writer, dev) != 0) {
+		close(dev->fd);
+		pthread_cond_destroy(&dev->changed);
+		pthread_mutex_destroy(&dev->lock);
+		free(dev);
+		return NULL;
+	}
+	pthread_detach(dev->thread);
+	return dev;
+}
+
+static enum teensy_error classify(int err)
+{
+	if (err == ENODEV || err == ESHUTDOWN)
+		return TEENSY_REOPEN; // gone, unless it's back on the same port
+	if (err == EMSGSIZE || err == EINVAL)
+		return TEENSY_ABORT; // a report HalfKay can't take
+	return TEENSY_RETRY;     // stalled, timed out or busy erasing
+}
+
+// opens the hidraw node of the device on the same port again, after it
+// dropped off the bus. Fails right away if it isn't there, or if the
+// thread is still writing to the old node
+static int reopen(struct teensy_device* dev)
+{
+	int fd = open_usb_device(0x16C0, 0x0478, dev->path, NULL);
+
+	pthread_mutex_lock(&dev->lock);
+	if (dev->pending) {
+		pthread_mutex_unlock(&dev->lock);
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+	close(dev->fd);
+	dev->fd = fd;
+	pthread_mutex_unlock(&dev->lock);
+	return fd >= 0;
+}
+
+int teensy_write_device(struct teensy_device* dev, void* buf, int len, double timeout)
+{
+	struct teensy_retry retry;
+	enum teensy_error   next;
+
+	teensy_retry_start(&retry, timeout);
+	while (dev->fd >= 0) {
+		if (write_device(dev, buf, len, teensy_retry_left(&retry)) == len)
+			return 1;
+		next = teensy_retry(&retry, classify(errno));
+		if (next == TEENSY_REOPEN && !(teensy_can_reopen(dev) && reopen(dev)))
+			next = teensy_retry(&retry, TEENSY_ABORT);
+		if (next != TEENSY_RETRY && next != TEENSY_REOPEN)
+			return 0;
+	}
+	return 0;
+}
+
+// a write that is still running is left to finish, the thread closes
+// the node and frees the device after it
+void teensy_close_device(struct teensy_device* dev)
+{
+	pthread_mutex_lock(&dev->lock);
+	dev->quit = 1;
+	pthread_cond_broadcast(&dev->changed);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+int hard_reboot(void)
+{
+	int r, rebootor_fd;
+
+	rebootor_fd = open_usb_device(0x16C0, 0x0477, NULL, NULL);
+	if (rebootor_fd < 0)
+		return 0;
+	r = write_report(rebootor_fd, "reboot", 6);
+	close(rebootor_fd);
+	if (r == 6)
+		return 1;
+	return 0;
+}
+
+// Teensyduino's USB serial reboots when its baud rate is set to 134
+int soft_reboot(void)
+{
+	DIR*           dir;
+	struct dirent* d;
+	struct termios tio;
+	char           path[512], uevent[1024], port[256], serial[64];
+	int            fd = -1, r = 0;
+
+	dir = opendir("/sys/class/tty");
+	if (!dir)
+		return 0;
+	while (fd < 0 && (d = readdir(dir)) != NULL) {
+		if (strncmp(d->d_name, "ttyACM", 6) != 0)
+			continue;
+		// the tty belongs to an interface, the USB device is its parent
+		snprintf(path, sizeof(path), "/sys/class/tty/%s/device/../uevent", d->d_name);
+		if (!read_sysfs(path, uevent, sizeof(uevent)) || !strstr(uevent, "PRODUCT=16c0/483/"))
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/tty/%s/device", d->d_name);
+		if (!usb_port(path, port, sizeof(port)) || !teensy_port_selected(0x0483, port))
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/tty/%s/device/../serial", d->d_name);
+		usb_serial(path, serial, sizeof(serial));
+		if (!teensy_serial_selected(0x0483, serial))
+			continue;
+		snprintf(path, sizeof(path), "/dev/%s", d->d_name);
+		fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	}
+	closedir(dir);
+	if (fd < 0) {
+		printf("Error opening USB serial device\n");
+		return 0;
+	}
+	if (tcgetattr(fd, &tio) == 0) {
+		cfsetospeed(&tio, B134);
+		cfsetispeed(&tio, B134);
+		r = tcsetattr(fd, TCSANOW, &tio) == 0;
+	}
+	close(fd);
+	if (!r)
+		printf("Unable to soft reboot, setting the baud rate failed\n");
+	else
+		teensy_pin(port, NULL); // HalfKay comes back on the same port
+	return r;
+}
@@ -29,6 +29,8 @@
 #include <IOKit/hid/IOHIDDevice.h>
 #include <IOKit/hid/IOHIDLib.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "misc.h"
 
@@ -36,6 +38,8 @@ struct usb_list_struct {
 	IOHIDDeviceRef          ref;
 	int                     pid;
 	int                     vid;
+	uint32_t                location;
+	char                    serial[64];
 	struct usb_list_struct* next;
 };
 
@@ -46,7 +50,7 @@ void attach_callback(void* context, IOReturn r, void* hid_mgr, IOHIDDeviceRef de
 {
 	CFTypeRef               type;
 	struct usb_list_struct *n, *p;
-	int32_t                 pid, vid;
+	int32_t                 pid, vid, location = 0;
 
 	if (!dev)
 		return;
@@ -60,14 +64,22 @@ void attach_callback(void* context, IOReturn r, void* hid_mgr, IOHIDDeviceRef de
 		return;
 	if (!CFNumberGetValue((CFNumberRef)type, kCFNumberSInt32Type, &pid))
 		return;
+	type = IOHIDDeviceGetProperty(dev, CFSTR(kIOHIDLocationIDKey));
+	if (type && CFGetTypeID(type) == CFNumberGetTypeID())
+		CFNumberGetValue((CFNumberRef)type, kCFNumberSInt32Type, &location);
 	n = (struct usb_list_struct*)malloc(sizeof(struct usb_list_struct));
 	if (!n)
 		return;
+	n->serial[0] = '\0';
+	type         = IOHIDDeviceGetProperty(dev, CFSTR(kIOHIDSerialNumberKey));
+	if (type && CFGetTypeID(type) == CFStringGetTypeID())
+		CFStringGetCString((CFStringRef)type, n->serial, sizeof(n->serial), kCFStringEncodingASCII);
 	//printf("attach callback: vid=%04X, pid=%04X\n", vid, pid);
-	n->ref  = dev;
-	n->vid  = vid;
-	n->pid  = pid;
-	n->next = NULL;
+	n->ref      = dev;
+	n->vid      = vid;
+	n->pid      = pid;
+	n->location = location;
+	n->next     = NULL;
 	if (usb_list == NULL) {
 		usb_list = n;
 	} else {
@@ -135,15 +147,28 @@ static void do_run_loop(void)
 		;
 }
 
-IOHIDDeviceRef open_usb_device(int vid, int pid)
+// formats the location ID, which tells apart devices with the same vid/pid
+static void location_path(const struct usb_list_struct* p, char* path, size_t size)
+{
+	snprintf(path, size, "%08x", (unsigned int)p->location);
+}
+
+// opens the first vid/pid device, or the one at path if it isn't NULL
+IOHIDDeviceRef open_usb_device(int vid, int pid, const char* path)
 {
 	struct usb_list_struct* p;
 	IOReturn                ret;
+	char                    buf[16];
 
 	init_hid_manager();
 	do_run_loop();
 	for (p = usb_list; p; p = p->next) {
 		if (p->vid == vid && p->pid == pid) {
+			location_path(p, buf, sizeof(buf));
+			if (path && strcmp(buf, path) != 0)
+				continue;
+			if (!teensy_port_selected(pid, buf) || !teensy_serial_selected(pid, p->serial))
+				continue;
 			ret = IOHIDDeviceOpen(p->ref, kIOHIDOptionsTypeNone);
 			if (ret == kIOReturnSuccess)
 				return p->ref;
@@ -165,45 +190,75 @@ void close_usb_device(IOHIDDeviceRef dev)
 	}
 }
 
-static IOHIDDeviceRef iokit_teensy_reference = NULL;
+int teensy_list(struct teensy_info* list, int max)
+{
+	struct usb_list_struct* p;
+	int                     count = 0;
+
+	init_hid_manager();
+	do_run_loop();
+	for (p = usb_list; p && count < max; p = p->next) {
+		if (p->vid != 0x16C0 || p->pid != 0x0478)
+			continue;
+		location_path(p, list[count].path, sizeof(list[0].path));
+		if (!teensy_port_selected(0x0478, list[count].path) || !teensy_serial_selected(0x0478, p->serial))
+			continue;
+		snprintf(list[count].serial, sizeof(list[0].serial), "%s", p->serial);
+		count++;
+	}
+	return count;
+}
+
+struct teensy_device {
+	IOHIDDeviceRef ref;
+};
+
+struct teensy_device* teensy_open_device(const struct teensy_info* info)
+{
+	struct teensy_device* dev;
+	IOHIDDeviceRef        ref;
+
+	ref = open_usb_device(0x16C0, 0x0478, info ? info->path : NULL);
+	if (!ref)
+		return NULL;
+	dev = (struct teensy_device*)malloc(sizeof(*dev));
+	if (!dev) {
+		close_usb_device(ref);
+		return NULL;
+	}
+	dev->ref = ref;
+	return dev;
+}
 
-int teensy_open(void)
+static enum teensy_error classify(IOReturn ret)
 {
-	teensy_close();
-	iokit_teensy_reference = open_usb_device(0x16C0, 0x0478);
-	if (iokit_teensy_reference)
-		return 1;
-	return 0;
+	if (ret == kIOReturnNotAttached || ret == kIOReturnNoDevice || ret == kIOReturnBadArgument)
+		return TEENSY_ABORT; // unplugged, or a report HalfKay can't take
+	return TEENSY_RETRY;     // stalled or busy erasing
 }
 
-int teensy_write(void* buf, int len, double timeout)
+int teensy_write_device(struct teensy_device* dev, void* buf, int len, double timeout)
 {
-	IOReturn ret;
+	struct teensy_retry retry;
+	IOReturn            ret;
 
 	// timeouts do not work on OS-X
 	// IOHIDDeviceSetReportWithCallback is not implemented
 	// even though Apple documents it with a code example!
 	// submitted to Apple on 22-sep-2009, problem ID 7245050
-	if (!iokit_teensy_reference)
-		return 0;
-
-	double start = CFAbsoluteTimeGetCurrent();
-	while (CFAbsoluteTimeGetCurrent() - timeout < start) {
-		ret = IOHIDDeviceSetReport(iokit_teensy_reference, kIOHIDReportTypeOutput, 0, buf, len);
+	teensy_retry_start(&retry, timeout);
+	do {
+		ret = IOHIDDeviceSetReport(dev->ref, kIOHIDReportTypeOutput, 0, buf, len);
 		if (ret == kIOReturnSuccess)
 			return 1;
-		usleep(10000);
-	}
-
+	} while (teensy_retry(&retry, classify(ret)) == TEENSY_RETRY);
 	return 0;
 }
 
-void teensy_close(void)
+void teensy_close_device(struct teensy_device* dev)
 {
-	if (!iokit_teensy_reference)
-		return;
-	close_usb_device(iokit_teensy_reference);
-	iokit_teensy_reference = NULL;
+	close_usb_device(dev->ref);
+	free(dev);
 }
 
 int hard_reboot(void)
@@ -211,7 +266,7 @@ int hard_reboot(void)
 	IOHIDDeviceRef rebootor;
 	IOReturn       ret;
 
-	rebootor = open_usb_device(0x16C0, 0x0477);
+	rebootor = open_usb_device(0x16C0, 0x0477, NULL);
 	if (!rebootor)
 		return 0;
 	ret = IOHIDDeviceSetReport(rebootor, kIOHIDReportTypeOutput, 0, (uint8_t*)("reboot"), 6);
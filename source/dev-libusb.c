@@ -33,17 +33,97 @@
 /****************************************************************/
 
 // http://libusb.sourceforge.net/doc/index.html
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <usb.h>
 #include "misc.h"
 
-usb_dev_handle* open_usb_device(int vid, int pid)
+#if defined(__linux__)
+#include <dirent.h>
+#include <fcntl.h>
+
+// reads a small sysfs attribute without its newline, returns 0 if it
+// doesn't exist
+static int read_sysfs(const char* name, const char* attr, char* buf, int size)
+{
+	char path[512];
+	int  fd, n;
+
+	snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/%s", name, attr);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	n = read(fd, buf, size - 1);
+	close(fd);
+	if (n < 0)
+		return 0;
+	buf[n]                  = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 1;
+}
+
+// finds the sysfs name of the device with this bus and device number,
+// "bus-port.port...", the same as hidraw and libusb 1.0 use for paths
+static int sysfs_name(struct usb_bus* bus, struct usb_device* dev, char* buf, int size)
+{
+	DIR*           dir;
+	struct dirent* d;
+	char           num[16];
+	int            found = 0;
+
+	dir = opendir("/sys/bus/usb/devices");
+	if (!dir)
+		return 0;
+	while (!found && (d = readdir(dir)) != NULL) {
+		// skip interfaces and root hubs, "1-1.2:1.0" and "usb1"
+		if (!strchr(d->d_name, '-') || strchr(d->d_name, ':'))
+			continue;
+		if (!read_sysfs(d->d_name, "busnum", num, sizeof(num)) || atoi(num) != atoi(bus->dirname))
+			continue;
+		if (!read_sysfs(d->d_name, "devnum", num, sizeof(num)) || atoi(num) != atoi(dev->filename))
+			continue;
+		snprintf(buf, size, "%s", d->d_name);
+		found = 1;
+	}
+	closedir(dir);
+	return found;
+}
+#endif
+
+// On Linux the path is the device's port, which stays the same while
+// it's plugged into the same port, also when it reboots into HalfKay.
+// Elsewhere libusb 0.1 has no port numbers, and "bus/device" changes
+// whenever the device is plugged in again or reboots. Returns 1 for a
+// port.
+static int device_path(struct usb_bus* bus, struct usb_device* dev, char* buf, int size)
+{
+#if defined(__linux__)
+	if (sysfs_name(bus, dev, buf, size))
+		return 1;
+#endif
+	snprintf(buf, size, "%.64s/%.64s", bus->dirname, dev->filename); // "001/004"
+	return 0;
+}
+
+// reads the serial number string, empty if the device has none
+static void device_serial(usb_dev_handle* h, struct usb_device* dev, char* buf, int size)
+{
+	buf[0] = '\0';
+	if (dev->descriptor.iSerialNumber && usb_get_string_simple(h, dev->descriptor.iSerialNumber, buf, size) < 0)
+		buf[0] = '\0';
+}
+
+// opens the first vid/pid device, or the one at path if it isn't NULL.
+// The path of the device is stored in opened if it isn't NULL
+usb_dev_handle* open_usb_device(int vid, int pid, const char* path, char* opened)
 {
 	struct usb_bus*    bus;
 	struct usb_device* dev;
 	usb_dev_handle*    h;
-	char               buf[128];
+	char               buf[256];
 	int                r;
 
 	usb_init();
@@ -61,11 +141,23 @@ usb_dev_handle* open_usb_device(int vid, int pid)
 				continue;
 			if (dev->descriptor.idProduct != pid)
 				continue;
+			device_path(bus, dev, buf, sizeof(buf));
+			if (path && strcmp(buf, path) != 0)
+				continue;
+			if (!teensy_port_selected(pid, buf))
+				continue;
+			if (opened)
+				strcpy(opened, buf);
 			h = usb_open(dev);
 			if (!h) {
 				printf_verbose("Found device but unable to open\n");
 				continue;
 			}
+			device_serial(h, dev, buf, sizeof(buf));
+			if (!teensy_serial_selected(pid, buf)) {
+				usb_close(h);
+				continue;
+			}
 #ifdef LIBUSB_HAS_GET_DRIVER_NP
 			r = usb_get_driver_np(h, 0, buf, sizeof(buf));
 			if (r >= 0) {
@@ -95,41 +187,134 @@ usb_dev_handle* open_usb_device(int vid, int pid)
 	return NULL;
 }
 
-static usb_dev_handle* libusb_teensy_handle = NULL;
+struct teensy_device {
+	usb_dev_handle* handle;
+	char            path[256];
+};
 
-int teensy_open(void)
+// a device that comes back on another path is found again by its serial
+// number, so it's always read. That needs the device to be opened,
+// unless sysfs has it. Returns 0 if it couldn't be read but is needed
+// to select the device.
+static int list_serial(struct usb_device* dev, const char* path, int port, char* buf, int size)
 {
-	teensy_close();
-	libusb_teensy_handle = open_usb_device(0x16C0, 0x0478);
-	if (libusb_teensy_handle)
+	usb_dev_handle* h;
+
+	buf[0] = '\0';
+#if defined(__linux__)
+	if (port) {
+		read_sysfs(path, "serial", buf, size);
 		return 1;
-	return 0;
+	}
+#else
+	(void)path;
+	(void)port;
+#endif
+	h = usb_open(dev);
+	if (!h)
+		return !teensy_serial_needed(0x0478);
+	device_serial(h, dev, buf, size);
+	usb_close(h);
+	return 1;
+}
+
+int teensy_list(struct teensy_info* list, int max)
+{
+	struct usb_bus*    bus;
+	struct usb_device* dev;
+	int                count = 0, port;
+
+	usb_init();
+	usb_find_busses();
+	usb_find_devices();
+	for (bus = usb_get_busses(); bus; bus = bus->next) {
+		for (dev = bus->devices; dev && count < max; dev = dev->next) {
+			if (dev->descriptor.idVendor != 0x16C0 || dev->descriptor.idProduct != 0x0478)
+				continue;
+			port = device_path(bus, dev, list[count].path, sizeof(list[count].path));
+			if (!teensy_port_selected(0x0478, list[count].path))
+				continue;
+			if (!list_serial(dev, list[count].path, port, list[count].serial, sizeof(list[count].serial)))
+				continue;
+			if (!teensy_serial_selected(0x0478, list[count].serial))
+				continue;
+			count++;
+		}
+	}
+	return count;
 }
 
-int teensy_write(void* buf, int len, double timeout)
+struct teensy_device* teensy_open_device(const struct teensy_info* info)
 {
-	int r;
+	struct teensy_device* dev;
+	usb_dev_handle*       h;
 
-	if (!libusb_teensy_handle)
+	dev = malloc(sizeof(*dev));
+	if (!dev)
+		return NULL;
+	h = open_usb_device(0x16C0, 0x0478, info ? info->path : NULL, dev->path);
+	if (!h) {
+		free(dev);
+		return NULL;
+	}
+	dev->handle = h;
+	return dev;
+}
+
+// usb_control_msg() returns -errno
+static enum teensy_error classify(int r)
+{
+	if (r == -ENODEV || r == -ENXIO)
+		return TEENSY_REOPEN; // gone, unless it's back at the same path
+	if (r == -EINVAL || r == -EMSGSIZE || r == -EOVERFLOW)
+		return TEENSY_ABORT;
+	return TEENSY_RETRY; // stalled, timed out or busy erasing
+}
+
+// opens the device at the same path again. Outside Linux the path
+// changes when it is plugged in again, so it's only found if it wasn't
+static int reopen(struct teensy_device* dev)
+{
+	usb_dev_handle* h;
+
+	usb_release_interface(dev->handle, 0);
+	usb_close(dev->handle);
+	h = open_usb_device(0x16C0, 0x0478, dev->path, NULL);
+	if (!h) {
+		dev->handle = NULL;
 		return 0;
-	while (timeout > 0) {
-		r = usb_control_msg(libusb_teensy_handle, 0x21, 9, 0x0200, 0, (char*)buf, len, (int)(timeout * 1000.0));
+	}
+	dev->handle = h;
+	return 1;
+}
+
+int teensy_write_device(struct teensy_device* dev, void* buf, int len, double timeout)
+{
+	struct teensy_retry retry;
+	enum teensy_error   next;
+	int                 r;
+
+	teensy_retry_start(&retry, timeout);
+	while (dev->handle) {
+		r = usb_control_msg(dev->handle, 0x21, 9, 0x0200, 0, (char*)buf, len, (int)(teensy_retry_left(&retry) * 1000.0) + 1);
 		if (r >= 0)
 			return 1;
-		//printf("teensy_write, r=%d\n", r);
-		usleep(10000);
-		timeout -= 0.01; // TODO: subtract actual elapsed time
+		next = teensy_retry(&retry, classify(r));
+		if (next == TEENSY_REOPEN && !(teensy_can_reopen(dev) && reopen(dev)))
+			next = teensy_retry(&retry, TEENSY_ABORT);
+		if (next != TEENSY_RETRY && next != TEENSY_REOPEN)
+			return 0;
 	}
 	return 0;
 }
 
-void teensy_close(void)
+void teensy_close_device(struct teensy_device* dev)
 {
-	if (!libusb_teensy_handle)
-		return;
-	usb_release_interface(libusb_teensy_handle, 0);
-	usb_close(libusb_teensy_handle);
-	libusb_teensy_handle = NULL;
+	if (dev->handle) {
+		usb_release_interface(dev->handle, 0);
+		usb_close(dev->handle);
+	}
+	free(dev);
 }
 
 int hard_reboot(void)
@@ -137,7 +322,7 @@ int hard_reboot(void)
 	usb_dev_handle* rebootor;
 	int             r;
 
-	rebootor = open_usb_device(0x16C0, 0x0477);
+	rebootor = open_usb_device(0x16C0, 0x0477, NULL, NULL);
 	if (!rebootor)
 		return 0;
 	r = usb_control_msg(rebootor, 0x21, 9, 0x0200, 0, "reboot", 6, 100);
@@ -150,9 +335,11 @@ int hard_reboot(void)
 
 int soft_reboot(void)
 {
-	usb_dev_handle* serial_handle = NULL;
+	usb_dev_handle*    serial_handle = NULL;
+	struct usb_device* dev;
+	char               serial[64], port[256];
 
-	serial_handle = open_usb_device(0x16C0, 0x0483);
+	serial_handle = open_usb_device(0x16C0, 0x0483, NULL, NULL);
 	if (!serial_handle) {
 		char* error = usb_strerror();
 		printf("Error opening USB device: %s\n", error);
@@ -162,6 +349,8 @@ int soft_reboot(void)
 	char reboot_command[] = {0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08};
 	int  response         = usb_control_msg(serial_handle, 0x21, 0x20, 0, 0, reboot_command, sizeof reboot_command, 10000);
 
+	dev = usb_device(serial_handle);
+	device_serial(serial_handle, dev, serial, sizeof(serial));
 	usb_release_interface(serial_handle, 0);
 	usb_close(serial_handle);
 
@@ -171,5 +360,11 @@ int soft_reboot(void)
 		return 0;
 	}
 
+	// HalfKay comes back on the same port. Without ports the path changes
+	// when HalfKay appears, the serial number stays the same
+	if (device_path(dev->bus, dev, port, sizeof(port)))
+		teensy_pin(port, NULL);
+	else
+		teensy_pin(NULL, serial);
 	return 1;
 }
@@ -0,0 +1,413 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "dev.h"
+
+/****************************************************************/
+/*                                                              */
+/*          USB Access - libusb-1.0 (Linux, FreeBSD, ...)       */
+/*                                                              */
+/*  Uses libusb v1.0. To install:                               */
+/*  - [debian, ubuntu, mint] apt install libusb-1.0-0-dev       */
+/*  - [redhat, centos]       yum install libusb1-devel          */
+/*  - [fedora]               dnf install libusb1-devel          */
+/*  - [arch linux]           pacman -S libusb                   */
+/*  - [gentoo]               emerge dev-libs/libusb             */
+/*                                                              */
+/*  - [freebsd]              part of the base system            */
+/****************************************************************/
+
+// https://libusb.sourceforge.io/api-1.0/
+#include <libusb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "misc.h"
+
+static libusb_context* libusb_ctx = NULL;
+
+// physical location, "bus-port.port...", the same as Linux sysfs uses
+static void device_path(libusb_device* dev, char* buf, int size)
+{
+	uint8_t ports[8];
+	int     n, i, len;
+
+	len = snprintf(buf, size, "%d", libusb_get_bus_number(dev));
+	n   = libusb_get_port_numbers(dev, ports, sizeof(ports));
+	for (i = 0; i < n && len < size; i++)
+		len += snprintf(buf + len, size - len, "%c%d", i ? '.' : '-', ports[i]);
+}
+
+// reads the serial number string, empty if the device has none
+static void device_serial(libusb_device_handle* h, int index, char* buf, int size)
+{
+	buf[0] = '\0';
+	if (index && libusb_get_string_descriptor_ascii(h, index, (unsigned char*)buf, size) < 0)
+		buf[0] = '\0';
+}
+
+static int init_libusb(void)
+{
+	if (!libusb_ctx && libusb_init(&libusb_ctx) < 0) {
+		libusb_ctx = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+// opens the first vid/pid device, or the one at path if it isn't NULL.
+// The path of the device is stored in opened if it isn't NULL
+static libusb_device_handle* open_usb_device(int vid, int pid, const char* path, char* opened)
+{
+	libusb_device**                 list;
+	libusb_device_handle*           h;
+	struct libusb_device_descriptor desc;
+	char                            buf[256], serial[64];
+	ssize_t                         count, i;
+	int                             r;
+
+	if (!init_libusb())
+		return NULL;
+	count = libusb_get_device_list(libusb_ctx, &list);
+	if (count < 0)
+		return NULL;
+	h = NULL;
+	for (i = 0; i < count && !h; i++) {
+		if (libusb_get_device_descriptor(list[i], &desc) < 0)
+			continue;
+		if (desc.idVendor != vid)
+			continue;
+		if (desc.idProduct != pid)
+			continue;
+		device_path(list[i], buf, sizeof(buf));
+		if (path && strcmp(buf, path) != 0)
+			continue;
+		if (!teensy_port_selected(pid, buf))
+			continue;
+		r = libusb_open(list[i], &h);
+		if (r < 0) {
+			printf_verbose("Found device but unable to open\n");
+			h = NULL;
+			continue;
+		}
+		device_serial(h, desc.iSerialNumber, serial, sizeof(serial));
+		if (!teensy_serial_selected(pid, serial)) {
+			libusb_close(h);
+			h = NULL;
+			continue;
+		}
+		// not supported everywhere, in which case claiming fails below
+		libusb_set_auto_detach_kernel_driver(h, 1);
+		r = libusb_claim_interface(h, 0);
+		if (r < 0) {
+			libusb_close(h);
+			h = NULL;
+			printf_verbose("Unable to claim interface, check USB permissions\n");
+			continue;
+		}
+		if (opened)
+			strcpy(opened, buf);
+	}
+	libusb_free_device_list(list, 1);
+	return h;
+}
+
+int teensy_list(struct teensy_info* list, int max)
+{
+	libusb_device**                 devs;
+	libusb_device_handle*           h;
+	struct libusb_device_descriptor desc;
+	ssize_t                         count, i;
+	int                             n = 0;
+
+	if (!init_libusb())
+		return 0;
+	count = libusb_get_device_list(libusb_ctx, &devs);
+	if (count < 0)
+		return 0;
+	for (i = 0; i < count && n < max; i++) {
+		if (libusb_get_device_descriptor(devs[i], &desc) < 0)
+			continue;
+		if (desc.idVendor != 0x16C0 || desc.idProduct != 0x0478)
+			continue;
+		device_path(devs[i], list[n].path, sizeof(list[n].path));
+		if (!teensy_port_selected(0x0478, list[n].path))
+			continue;
+		// the serial number needs the device to be opened. It's always
+		// read, so the daemon can match jobs against listed devices
+		list[n].serial[0] = '\0';
+		if (libusb_open(devs[i], &h) == 0) {
+			device_serial(h, desc.iSerialNumber, list[n].serial, sizeof(list[n].serial));
+			libusb_close(h);
+		} else if (teensy_serial_needed(0x0478)) {
+			continue;
+		}
+		if (!teensy_serial_selected(0x0478, list[n].serial))
+			continue;
+		n++;
+	}
+	libusb_free_device_list(devs, 1);
+	return n;
+}
+
+// each device has at most one write in flight, HalfKay only ever
+// handles one at a time
+struct teensy_device {
+	libusb_device_handle*   handle;
+	struct libusb_transfer* transfer;
+	unsigned char*          buffer; // setup packet followed by the report
+	int                     buffer_size;
+	int                     active;
+	int                     wake;     // set by the transfer callback
+	struct teensy_retry     retry;    // deadline and backoff of the write
+	double                  retry_at; // resubmit once this passes, 0 if submitted
+	teensy_write_callback   callback;
+	void*                   arg;
+	char                    path[256]; // to open it again
+};
+
+struct teensy_device* teensy_open_device(const struct teensy_info* info)
+{
+	struct teensy_device* dev;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+	dev->transfer = libusb_alloc_transfer(0);
+	if (dev->transfer)
+		dev->handle = open_usb_device(0x16C0, 0x0478, info ? info->path : NULL, dev->path);
+	if (!dev->handle) {
+		if (dev->transfer)
+			libusb_free_transfer(dev->transfer);
+		free(dev);
+		return NULL;
+	}
+	return dev;
+}
+
+static void finish_write(struct teensy_device* dev, int result)
+{
+	dev->active   = 0;
+	dev->retry_at = 0.0;
+	if (dev->callback)
+		dev->callback(dev->arg, result);
+}
+
+static int submit_write(struct teensy_device* dev)
+{
+	dev->retry_at          = 0.0;
+	dev->transfer->timeout = (unsigned int)(teensy_retry_left(&dev->retry) * 1000.0) + 1;
+	return libusb_submit_transfer(dev->transfer) == 0;
+}
+
+// may run on any thread handling libusb events, the owner of the
+// device is woken up and finishes or retries the write
+static void LIBUSB_CALL write_complete(struct libusb_transfer* transfer)
+{
+	struct teensy_device* dev = transfer->user_data;
+
+	dev->wake = 1;
+}
+
+/* submits a HID SET_REPORT without waiting for it. The callback runs */
+/* from teensy_handle_events() once the device accepted the report or */
+/* the timeout passed. Returns 0 if the write could not be started. */
+int teensy_write_async(struct teensy_device* dev, void* buf, int len, double timeout, teensy_write_callback callback, void* arg)
+{
+	unsigned char* data;
+
+	if (dev->active || !dev->handle)
+		return 0;
+	if (dev->buffer_size < LIBUSB_CONTROL_SETUP_SIZE + len) {
+		data = realloc(dev->buffer, LIBUSB_CONTROL_SETUP_SIZE + len);
+		if (!data)
+			return 0;
+		dev->buffer      = data;
+		dev->buffer_size = LIBUSB_CONTROL_SETUP_SIZE + len;
+	}
+	libusb_fill_control_setup(dev->buffer, 0x21, 9, 0x0200, 0, len);
+	memcpy(dev->buffer + LIBUSB_CONTROL_SETUP_SIZE, buf, len);
+	libusb_fill_control_transfer(dev->transfer, dev->handle, dev->buffer, write_complete, dev, 0);
+	teensy_retry_start(&dev->retry, timeout);
+	dev->callback = callback;
+	dev->arg      = arg;
+	dev->active   = 1;
+	dev->wake     = 0;
+	if (!submit_write(dev)) {
+		dev->active = 0;
+		return 0;
+	}
+	return 1;
+}
+
+static enum teensy_error classify(enum libusb_transfer_status status)
+{
+	switch (status) {
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return TEENSY_REOPEN; // gone, unless it's back on the same port
+	case LIBUSB_TRANSFER_CANCELLED: // closing, or far past the deadline
+	case LIBUSB_TRANSFER_OVERFLOW:
+		return TEENSY_ABORT;
+	default:
+		return TEENSY_RETRY; // stalled, timed out or busy erasing
+	}
+}
+
+// opens the device on the same port again, after it dropped off the
+// bus. Fails right away if it isn't there
+static int reopen(struct teensy_device* dev)
+{
+	libusb_release_interface(dev->handle, 0);
+	libusb_close(dev->handle);
+	dev->handle = open_usb_device(0x16C0, 0x0478, dev->path, NULL);
+	if (!dev->handle)
+		return 0;
+	dev->transfer->dev_handle = dev->handle;
+	return 1;
+}
+
+// looks at a completed transfer, finishing the write or scheduling a retry
+static void transfer_done(struct teensy_device* dev)
+{
+	enum teensy_error next;
+
+	dev->wake = 0;
+	if (dev->transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		finish_write(dev, 1);
+		return;
+	}
+	next = teensy_retry_next(&dev->retry, classify(dev->transfer->status));
+	if (next == TEENSY_REOPEN && !(teensy_can_reopen(dev) && reopen(dev)))
+		next = teensy_retry_next(&dev->retry, TEENSY_ABORT);
+	if (next == TEENSY_RETRY)
+		dev->retry_at = monotonic_time() + dev->retry.wait;
+	else if (next == TEENSY_REOPEN)
+		dev->retry_at = monotonic_time();
+	else
+		finish_write(dev, 0);
+}
+
+/* runs libusb events for up to timeout seconds, returns early once */
+/* the write on dev has finished */
+void teensy_handle_events(struct teensy_device* dev, double timeout)
+{
+	struct timeval tv;
+	double         now, end, until;
+
+	now = monotonic_time();
+	end = now + timeout;
+	while (dev->active && now < end) {
+		if (dev->retry_at > 0.0 && now >= dev->retry_at) {
+			if (!submit_write(dev)) {
+				finish_write(dev, 0);
+				break;
+			}
+		}
+		until = end;
+		if (dev->retry_at > 0.0 && dev->retry_at < until)
+			until = dev->retry_at;
+		tv.tv_sec  = (long)(until - now);
+		tv.tv_usec = (long)((until - now - tv.tv_sec) * 1000000.0);
+		libusb_handle_events_timeout_completed(libusb_ctx, &tv, &dev->wake);
+		if (dev->wake)
+			transfer_done(dev);
+		now = monotonic_time();
+		// the transfer timeout normally fires first, this is a backstop
+		if (dev->active && dev->retry_at == 0.0 && now > dev->retry.deadline + 0.1)
+			libusb_cancel_transfer(dev->transfer);
+	}
+}
+
+static void write_done(void* arg, int result)
+{
+	*(int*)arg = result;
+}
+
+int teensy_write_device(struct teensy_device* dev, void* buf, int len, double timeout)
+{
+	int result = -1;
+
+	if (!teensy_write_async(dev, buf, len, timeout, write_done, &result))
+		return 0;
+	while (result < 0)
+		teensy_handle_events(dev, timeout + 1.0);
+	return result;
+}
+
+void teensy_close_device(struct teensy_device* dev)
+{
+	if (dev->active && dev->retry_at > 0.0) {
+		finish_write(dev, 0); // waiting to be resubmitted, nothing in flight
+	} else if (dev->active) {
+		libusb_cancel_transfer(dev->transfer);
+		while (dev->active)
+			teensy_handle_events(dev, 1.0);
+	}
+	libusb_free_transfer(dev->transfer);
+	free(dev->buffer);
+	if (dev->handle) {
+		libusb_release_interface(dev->handle, 0);
+		libusb_close(dev->handle);
+	}
+	free(dev);
+}
+
+int hard_reboot(void)
+{
+	libusb_device_handle* rebootor;
+	int                   r;
+
+	rebootor = open_usb_device(0x16C0, 0x0477, NULL, NULL);
+	if (!rebootor)
+		return 0;
+	r = libusb_control_transfer(rebootor, 0x21, 9, 0x0200, 0, (unsigned char*)"reboot", 6, 100);
+	libusb_release_interface(rebootor, 0);
+	libusb_close(rebootor);
+	if (r < 0)
+		return 0;
+	return 1;
+}
+
+int soft_reboot(void)
+{
+	libusb_device_handle* serial_handle = NULL;
+	char                  port[256];
+
+	serial_handle = open_usb_device(0x16C0, 0x0483, NULL, NULL);
+	if (!serial_handle) {
+		printf("Error opening USB device\n");
+		return 0;
+	}
+
+	// CDC SET_LINE_CODING to 134 baud asks Teensyduino code to reboot
+	unsigned char reboot_command[] = {0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08};
+	int           response         = libusb_control_transfer(serial_handle, 0x21, 0x20, 0, 0, reboot_command, sizeof reboot_command, 10000);
+
+	device_path(libusb_get_device(serial_handle), port, sizeof(port));
+	libusb_release_interface(serial_handle, 0);
+	libusb_close(serial_handle);
+
+	if (response < 0) {
+		printf("Unable to soft reboot with USB error: %s\n", libusb_error_name(response));
+		return 0;
+	}
+
+	// HalfKay comes back on the same port
+	teensy_pin(port, NULL);
+	return 1;
+}
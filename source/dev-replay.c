@@ -0,0 +1,269 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "dev.h"
+
+/****************************************************************/
+/*                                                              */
+/*             USB Access - Replay of a Recorded Session        */
+/*                                                              */
+/****************************************************************/
+
+#include "dev-replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mapfile.h"
+#include "misc.h"
+#include "record.h"
+#include "stats.h"
+
+#define REPLAY_MAX_DEVICES 64
+
+struct replay_entry {
+	const unsigned char* report;
+	int                  len;
+	double               latency;
+	int                  result;
+	int                  attempts;
+	enum teensy_error    error; // how a failed write ended
+};
+
+struct teensy_device {
+	struct replay_entry* entries;
+	int                  count;
+	int                  alloc;
+	int                  next;      // entries before this were replayed
+	int                  open;
+	int                  writes;    // made during the replay
+	int                  unmatched; // not in the recording, failed
+	int                  differ;    // same address, different data
+	int                  timeouts;  // recorded as slower than the timeout
+	double               recorded;  // time of all recorded writes
+	double               replayed;  // time spent replaying
+};
+
+static struct mapped_file   recording;
+static struct teensy_device devices[REPLAY_MAX_DEVICES];
+static int                  device_count = 0;
+
+static unsigned int get16(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned long get32(const unsigned char* p)
+{
+	return get16(p) | ((unsigned long)get16(p + 2) << 16);
+}
+
+static int add_entry(struct teensy_device* dev, const struct replay_entry* entry)
+{
+	struct replay_entry* p;
+
+	if (dev->count == dev->alloc) {
+		p = (struct replay_entry*)realloc(dev->entries, (dev->alloc ? dev->alloc * 2 : 256) * sizeof(*p));
+		if (!p)
+			return 0;
+		dev->entries = p;
+		dev->alloc   = dev->alloc ? dev->alloc * 2 : 256;
+	}
+	dev->entries[dev->count++] = *entry;
+	dev->recorded += entry->latency;
+	return 1;
+}
+
+static void print_summary(void)
+{
+	struct teensy_device* dev;
+	int                   i;
+
+	for (i = 0; i < device_count; i++) {
+		dev = &devices[i];
+		printf("replay%d: %d writes, %d failed not recorded, %d timed out, %d with different data, %.2f of %.2f recorded seconds replayed\n", i, dev->writes, dev->unmatched, dev->timeouts, dev->differ, dev->replayed, dev->recorded);
+	}
+}
+
+// loads a recording, the reports point into the mapped file
+int replay_open(const char* filename)
+{
+	const unsigned char* p;
+	const unsigned char* end;
+	struct replay_entry  entry;
+	unsigned int         device;
+	int                  entry_size;
+
+	if (!map_file(filename, &recording))
+		return 0;
+	p   = (const unsigned char*)recording.data;
+	end = p + recording.size;
+	if (recording.size < RECORD_HEADER_SIZE || memcmp(p, RECORD_MAGIC, 5) != 0 || p[5] < 1 || p[5] > RECORD_VERSION) {
+		unmap_file(&recording);
+		return 0;
+	}
+	entry_size = p[5] == 1 ? RECORD_V1_ENTRY_SIZE : RECORD_ENTRY_SIZE;
+	for (p += RECORD_HEADER_SIZE; end - p >= entry_size; p += entry_size + entry.len) {
+		device         = get16(p);
+		entry.len      = get16(p + 2);
+		entry.latency  = (double)get32(p + 8) / 1000000.0;
+		entry.result   = p[12];
+		entry.attempts = p[13];
+		entry.error    = entry_size > RECORD_V1_ENTRY_SIZE ? (enum teensy_error)p[14] : TEENSY_TIMEOUT;
+		entry.report   = p + entry_size;
+		if (end - entry.report < entry.len)
+			break; // cut short, the recording program died while writing
+		if (device >= REPLAY_MAX_DEVICES)
+			continue;
+		if (!add_entry(&devices[device], &entry))
+			return 0;
+		if ((int)device >= device_count)
+			device_count = device + 1;
+	}
+	atexit(print_summary);
+	return 1;
+}
+
+static void device_path(int index, char* path, int size)
+{
+	snprintf(path, size, "replay%d", index);
+}
+
+static int device_selected(int index)
+{
+	char path[24];
+
+	device_path(index, path, sizeof(path));
+	return teensy_port_selected(0x0478, path) && teensy_serial_selected(0x0478, "");
+}
+
+int teensy_list(struct teensy_info* list, int max)
+{
+	int i, count = 0;
+
+	for (i = 0; i < device_count && count < max; i++) {
+		if (!device_selected(i))
+			continue;
+		device_path(i, list[count].path, sizeof(list[0].path));
+		list[count].serial[0] = '\0';
+		count++;
+	}
+	return count;
+}
+
+struct teensy_device* teensy_open_device(const struct teensy_info* info)
+{
+	char path[24];
+	int  i;
+
+	for (i = 0; i < device_count; i++) {
+		if (devices[i].open || !device_selected(i))
+			continue;
+		device_path(i, path, sizeof(path));
+		if (info && strcmp(info->path, path) != 0)
+			continue;
+		devices[i].open = 1;
+		return &devices[i];
+	}
+	return NULL;
+}
+
+// the address part of the report header, which the match is made on
+static int header_size(int len)
+{
+	return len == 512 + 64 || len == 1024 + 64 ? 3 : 2;
+}
+
+// average time of the recorded writes after the erase, for writes
+// which weren't recorded
+static double average_latency(const struct teensy_device* dev)
+{
+	double total = 0.0;
+	int    i;
+
+	for (i = 1; i < dev->count; i++)
+		total += dev->entries[i].latency;
+	return dev->count > 1 ? total / (dev->count - 1) : 0.0;
+}
+
+// fails the write the way a backend would, for teensy_write_error()
+static int fail(enum teensy_error error)
+{
+	struct teensy_retry retry;
+
+	teensy_retry_start(&retry, 0.0);
+	teensy_retry_next(&retry, error);
+	return 0;
+}
+
+int teensy_write_device(struct teensy_device* dev, void* buf, int len, double timeout)
+{
+	struct replay_entry* entry = NULL;
+	double               latency;
+	int                  i;
+
+	dev->writes++;
+	for (i = dev->next; i < dev->count; i++) {
+		if (dev->entries[i].len == len && memcmp(dev->entries[i].report, buf, header_size(len)) == 0) {
+			entry = &dev->entries[i];
+			break;
+		}
+	}
+	if (!entry) {
+		dev->unmatched++;
+		latency = average_latency(dev);
+	} else {
+		if (memcmp(entry->report, buf, len) != 0)
+			dev->differ++;
+		latency = entry->latency;
+		if (entry->attempts > entry->result)
+			stats_add(STATS_RETRIES, entry->attempts - entry->result);
+	}
+	// a write that took longer than the timeout now allows would have
+	// timed out on the real board
+	if (latency > timeout) {
+		delay(timeout);
+		dev->replayed += timeout;
+		dev->timeouts++;
+		return fail(TEENSY_TIMEOUT); // sent again, it matches the same write
+	}
+	if (entry)
+		dev->next = (int)(entry - dev->entries) + 1;
+	delay(latency);
+	dev->replayed += latency;
+	// what the board would have said to a write it never got is unknown
+	if (!entry)
+		return fail(TEENSY_ABORT);
+	if (!entry->result)
+		return fail(entry->error == TEENSY_ABORT ? TEENSY_ABORT : TEENSY_TIMEOUT);
+	return 1;
+}
+
+void teensy_close_device(struct teensy_device* dev)
+{
+	dev->open = 0;
+}
+
+int hard_reboot(void)
+{
+	return 0;
+}
+
+int soft_reboot(void)
+{
+	return 0;
+}
@@ -0,0 +1,27 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+// Replayed HalfKay Devices (dev-replay.c)
+// A backend built instead of a USB backend, which plays back a session
+// recorded with --record. Each write is matched to the recorded write
+// to the same address, then takes as long and has the same result as
+// it did then, so changes to the programming loop can be timed against
+// real hardware. A write that took longer than its timeout now allows
+// times out, and writes that weren't recorded fail. A summary is
+// printed when the program exits.
+int replay_open(const char* filename);
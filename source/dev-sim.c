@@ -0,0 +1,359 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "dev.h"
+
+/****************************************************************/
+/*                                                              */
+/*              USB Access - Simulated HalfKay Devices          */
+/*                                                              */
+/****************************************************************/
+
+#include "dev-sim.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "misc.h"
+
+#define SIM_MAX_DEVICES 64
+
+// Rough HalfKay timings per MCU family, estimates rather than
+// measurements. The chip is erased when the first block arrives, which
+// takes longer the more flash there is. The Teensy 4 QSPI flash is
+// erased as the blocks reach it instead, like program.c assumes. The
+// last matching row is used.
+static const struct {
+	int    block_size;
+	int    code_size; // smallest flash of the family
+	double erase_time;
+	double erase_per_mb;
+	double block_time;
+	int    erase_image; // erase_per_mb is spent on each block written
+} timings[] = {
+	{128, 0, 0.010, 0.0, 0.0045, 0},          // AVR, Teensy 2.0
+	{256, 0, 0.020, 0.0, 0.0045, 0},          // AVR, Teensy++ 2.0
+	{512, 0, 0.030, 0.0, 0.0020, 0},          // Kinetis L, Teensy LC
+	{1024, 0, 0.050, 0.250, 0.0030, 0},       // Kinetis K, Teensy 3.x
+	{1024, 2031616, 0.100, 2.000, 0.0020, 1}, // IMXRT with QSPI flash, Teensy 4.x
+};
+
+struct teensy_device {
+	unsigned char* flash;
+	int            open;
+	int            erased;
+	uint32_t       next; // blocks have to arrive in order, each only once
+	int            booted;
+	int            blocks;
+	int            errors;
+	double         device_time;
+	enum sim_fault fault;
+	int            fault_at;    // blocks accepted before the fault
+	int            fault_count; // times it's still to happen
+	int            dropped;     // the open handle stopped working
+	int            moved;       // and the device came back on a new path
+	int            enumerations;
+	int            unplugged;
+};
+
+static struct teensy_device devices[SIM_MAX_DEVICES];
+static int                  device_count   = 0;
+static int                  sim_code_size  = 0;
+static int                  sim_block_size = 0;
+static double               sim_speed      = 0.0;
+static double               erase_time     = 0.0;
+static double               block_time     = 0.0;
+
+// creates count devices in HalfKay, their flash still holds the old
+// code (all zeros) until the first block erases it
+void sim_setup(int count, int code_size, int block_size, double speed)
+{
+	int i;
+
+	for (i = 0; i < device_count; i++)
+		free(devices[i].flash);
+	memset(devices, 0, sizeof(devices));
+	device_count   = count < SIM_MAX_DEVICES ? count : SIM_MAX_DEVICES;
+	sim_code_size  = code_size;
+	sim_block_size = block_size;
+	sim_speed      = speed;
+	for (i = 0; i < (int)(sizeof(timings) / sizeof(timings[0])); i++) {
+		if (timings[i].block_size == block_size && timings[i].code_size <= code_size) {
+			erase_time = timings[i].erase_time;
+			block_time = timings[i].block_time;
+			if (timings[i].erase_image)
+				block_time += timings[i].erase_per_mb * block_size / 1048576.0;
+			else
+				erase_time += timings[i].erase_per_mb * code_size / 1048576.0;
+		}
+	}
+	for (i = 0; i < device_count; i++) {
+		devices[i].flash = (unsigned char*)calloc(1, code_size);
+		if (!devices[i].flash)
+			die("Unable to allocate %d bytes for the simulated flash\n", code_size);
+	}
+}
+
+const unsigned char* sim_flash(int index)
+{
+	return devices[index].flash;
+}
+
+int sim_blocks(int index)
+{
+	return devices[index].blocks;
+}
+
+int sim_booted(int index)
+{
+	return devices[index].booted;
+}
+
+int sim_errors(int index)
+{
+	return devices[index].errors;
+}
+
+// modeled time the device spent erasing and writing
+double sim_device_time(int index)
+{
+	return devices[index].device_time;
+}
+
+// a new path each time the device is enumerated again, like libusb
+// 0.1's bus/device numbers
+static void device_path(int index, char* path, int size)
+{
+	if (devices[index].enumerations)
+		snprintf(path, size, "sim%d.%d", index, devices[index].enumerations);
+	else
+		snprintf(path, size, "sim%d", index);
+}
+
+// HalfKay reports the serial number in hex
+static void device_serial(int index, char* serial, int size)
+{
+	snprintf(serial, size, "%08X", 100000 + index);
+}
+
+static int device_selected(int index)
+{
+	char path[16], serial[16];
+
+	if (devices[index].booted || devices[index].unplugged)
+		return 0;
+	device_path(index, path, sizeof(path));
+	device_serial(index, serial, sizeof(serial));
+	return teensy_port_selected(0x0478, path) && teensy_serial_selected(0x0478, serial);
+}
+
+void sim_fault(int index, int after, enum sim_fault fault, int count)
+{
+	devices[index].fault       = fault;
+	devices[index].fault_at    = after;
+	devices[index].fault_count = count;
+}
+
+int teensy_list(struct teensy_info* list, int max)
+{
+	int i, count = 0;
+
+	for (i = 0; i < device_count && count < max; i++) {
+		if (!device_selected(i))
+			continue;
+		device_path(i, list[count].path, sizeof(list[0].path));
+		device_serial(i, list[count].serial, sizeof(list[0].serial));
+		count++;
+	}
+	return count;
+}
+
+struct teensy_device* teensy_open_device(const struct teensy_info* info)
+{
+	char path[16];
+	int  i;
+
+	for (i = 0; i < device_count; i++) {
+		if (devices[i].open || !device_selected(i))
+			continue;
+		device_path(i, path, sizeof(path));
+		if (info && strcmp(info->path, path) != 0)
+			continue;
+		devices[i].open    = 1;
+		devices[i].dropped = 0;
+		devices[i].moved   = 0;
+		return &devices[i];
+	}
+	return NULL;
+}
+
+static void elapse(struct teensy_device* dev, double seconds)
+{
+	dev->device_time += seconds;
+	if (sim_speed > 0.0)
+		delay(seconds * sim_speed);
+}
+
+// HalfKay doesn't acknowledge reports it can't make sense of
+static enum teensy_error reject(struct teensy_device* dev)
+{
+	dev->errors++;
+	return TEENSY_ABORT;
+}
+
+// the fault due at this point, -1 if there is none
+static int fault(struct teensy_device* dev)
+{
+	if (dev->unplugged || dev->booted)
+		return TEENSY_ABORT; // gone from the bus, or running the user's code
+	if (dev->dropped)
+		return TEENSY_REOPEN;
+	if (dev->fault_count <= 0 || dev->blocks < dev->fault_at)
+		return -1;
+	dev->fault_count--;
+	switch (dev->fault) {
+	case SIM_STALL:
+		return TEENSY_RETRY;
+	case SIM_DROP:
+		dev->dropped = 1;
+		return TEENSY_REOPEN;
+	case SIM_REENUMERATE:
+		dev->dropped = 1;
+		dev->moved   = 1;
+		dev->enumerations++;
+		return TEENSY_REOPEN;
+	default:
+		dev->unplugged = 1;
+		return TEENSY_ABORT;
+	}
+}
+
+// decodes the report the same way HalfKay does, see program_image().
+// Returns -1 if the device took it, or how it failed
+static int attempt(struct teensy_device* dev, const unsigned char* p, int len, double timeout)
+{
+	uint32_t addr;
+	int      header, r;
+	double   seconds = block_time;
+
+	r = fault(dev);
+	if (r >= 0)
+		return r;
+	if (sim_block_size <= 256 && sim_code_size < 0x10000) {
+		addr   = p[0] | (p[1] << 8);
+		header = 2;
+	} else if (sim_block_size == 256) {
+		addr   = (p[0] << 8) | (p[1] << 16);
+		header = 2;
+	} else {
+		addr   = p[0] | (p[1] << 8) | (p[2] << 16);
+		header = 64;
+	}
+	if (len != sim_block_size + header)
+		return reject(dev);
+	if (addr >= (uint32_t)sim_code_size) {
+		// all ones is the boot request, anything else is out of range
+		if (p[0] != 0xFF || p[1] != 0xFF || (header == 64 && p[2] != 0xFF))
+			return reject(dev);
+		dev->booted = 1;
+		return -1;
+	}
+	if (addr % sim_block_size)
+		return reject(dev);
+	if (!dev->erased) {
+		// the first block erases the chip, and is always at 0
+		if (addr != 0)
+			return reject(dev);
+		seconds += erase_time;
+	} else if (addr < dev->next) {
+		return reject(dev);
+	}
+	if (seconds > timeout) {
+		elapse(dev, timeout);
+		return TEENSY_TIMEOUT;
+	}
+	elapse(dev, seconds);
+	if (!dev->erased) {
+		memset(dev->flash, 0xFF, sim_code_size);
+		dev->erased = 1;
+	}
+	memcpy(dev->flash + addr, p + header, sim_block_size);
+	dev->next = addr + sim_block_size;
+	dev->blocks++;
+	return -1;
+}
+
+// a dropped device is back on the same path right away
+static int reopen(struct teensy_device* dev)
+{
+	if (dev->unplugged || dev->moved)
+		return 0;
+	dev->dropped = 0;
+	return 1;
+}
+
+// failures go through the retry engine, like on a USB backend
+int teensy_write_device(struct teensy_device* dev, void* buf, int len, double timeout)
+{
+	struct teensy_retry retry;
+	enum teensy_error   next;
+	int                 r;
+
+	teensy_retry_start(&retry, timeout);
+	while (1) {
+		r = attempt(dev, (const unsigned char*)buf, len, teensy_retry_left(&retry));
+		if (r < 0)
+			return 1;
+		next = teensy_retry(&retry, (enum teensy_error)r);
+		if (next == TEENSY_REOPEN && !(teensy_can_reopen(dev) && reopen(dev)))
+			next = teensy_retry(&retry, TEENSY_ABORT);
+		if (next != TEENSY_RETRY && next != TEENSY_REOPEN)
+			return 0;
+	}
+}
+
+void teensy_close_device(struct teensy_device* dev)
+{
+	dev->open = 0;
+}
+
+// puts every booted device back into HalfKay
+static int reboot_devices(void)
+{
+	int i, count = 0;
+
+	for (i = 0; i < device_count; i++) {
+		if (devices[i].booted) {
+			devices[i].booted = 0;
+			devices[i].erased = 0;
+			devices[i].next   = 0;
+			count++;
+		}
+	}
+	return count > 0;
+}
+
+int hard_reboot(void)
+{
+	return reboot_devices();
+}
+
+int soft_reboot(void)
+{
+	return reboot_devices();
+}
@@ -0,0 +1,43 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+// Simulated HalfKay Devices (dev-sim.c)
+// An in-process backend for benchmarks and tests, built instead of a
+// USB backend. Each device decodes the reports program_image() sends,
+// keeps a copy of its flash and models how long HalfKay takes to erase
+// and write. speed scales the modeled delays, 0 only counts them.
+// Failed writes go through teensy_retry() like on USB.
+// sim_fault() makes device index fail count times once it has accepted
+// after blocks: SIM_STALL stalls one attempt, SIM_DROP stops its handle
+// working while it stays listed on the same path, SIM_REENUMERATE does
+// the same but lists it on a new path with the same serial number, and
+// SIM_UNPLUG takes it off the bus for good. sim_setup() clears faults.
+enum sim_fault {
+	SIM_STALL,
+	SIM_DROP,
+	SIM_REENUMERATE,
+	SIM_UNPLUG,
+};
+
+void                 sim_setup(int count, int code_size, int block_size, double speed);
+void                 sim_fault(int index, int after, enum sim_fault fault, int count);
+const unsigned char* sim_flash(int index);
+int                  sim_blocks(int index);
+int                  sim_booted(int index);
+int                  sim_errors(int index);
+double               sim_device_time(int index);
@@ -29,14 +29,19 @@
 
 #include <dev/usb/usb.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
 #ifndef USB_GET_DEVICEINFO
 #include <dev/usb/usb_ioctl.h>
 #endif
 
-int open_usb_device(int vid, int pid)
+// opens the first vid/pid device, or the one at path if it isn't NULL
+int open_usb_device(int vid, int pid, const char* path)
 {
 	int                    r, fd;
 	DIR*                   dir;
@@ -51,6 +56,10 @@ int open_usb_device(int vid, int pid)
 		if (strncmp(d->d_name, "uhid", 4) != 0)
 			continue;
 		snprintf(buf, sizeof(buf), "/dev/%s", d->d_name);
+		if (path && strcmp(buf, path) != 0)
+			continue;
+		if (!teensy_port_selected(pid, buf))
+			continue;
 		fd = open(buf, O_RDWR);
 		if (fd < 0)
 			continue;
@@ -66,7 +75,7 @@ int open_usb_device(int vid, int pid)
 			exit(1);
 		}
 		//printf("%s: v=%d, p=%d\n", buf, info.udi_vendorNo, info.udi_productNo);
-		if (info.udi_vendorNo == vid && info.udi_productNo == pid) {
+		if (info.udi_vendorNo == vid && info.udi_productNo == pid && teensy_serial_selected(pid, info.udi_serial)) {
 			closedir(dir);
 			return fd;
 		}
@@ -76,41 +85,89 @@ int open_usb_device(int vid, int pid)
 	return -1;
 }
 
-static int uhid_teensy_fd = -1;
-
-int teensy_open(void)
+int teensy_list(struct teensy_info* list, int max)
 {
-	teensy_close();
-	uhid_teensy_fd = open_usb_device(0x16C0, 0x0478);
-	if (uhid_teensy_fd < 0)
+	DIR*                   dir;
+	struct dirent*         d;
+	struct usb_device_info info;
+	int                    fd, count = 0;
+
+	dir = opendir("/dev");
+	if (!dir)
 		return 0;
-	return 1;
+	while (count < max && (d = readdir(dir)) != NULL) {
+		if (strncmp(d->d_name, "uhid", 4) != 0)
+			continue;
+		snprintf(list[count].path, sizeof(list[count].path), "/dev/%s", d->d_name);
+		if (!teensy_port_selected(0x0478, list[count].path))
+			continue;
+		fd = open(list[count].path, O_RDWR);
+		if (fd < 0)
+			continue;
+		if (ioctl(fd, USB_GET_DEVICEINFO, &info) == 0 && info.udi_vendorNo == 0x16C0 && info.udi_productNo == 0x0478 && teensy_serial_selected(0x0478, info.udi_serial)) {
+			snprintf(list[count].serial, sizeof(list[count].serial), "%s", info.udi_serial);
+			count++;
+		}
+		close(fd);
+	}
+	closedir(dir);
+	return count;
 }
 
-int teensy_write(void* buf, int len, double timeout)
+struct teensy_device {
+	int fd;
+};
+
+struct teensy_device* teensy_open_device(const struct teensy_info* info)
 {
-	int r;
+	struct teensy_device* dev;
+	int                   fd;
+
+	fd = open_usb_device(0x16C0, 0x0478, info ? info->path : NULL);
+	if (fd < 0)
+		return NULL;
+	dev = malloc(sizeof(*dev));
+	if (!dev) {
+		close(fd);
+		return NULL;
+	}
+	dev->fd = fd;
+	return dev;
+}
+
+static enum teensy_error classify(int err)
+{
+	if (err == ENXIO || err == ENODEV || err == EMSGSIZE || err == EINVAL)
+		return TEENSY_ABORT; // unplugged, or a report HalfKay can't take
+	return TEENSY_RETRY;     // stalled or busy erasing
+}
+
+int teensy_write_device(struct teensy_device* dev, void* buf, int len, double timeout)
+{
+	struct teensy_retry retry;
+	int                 r;
 
 	// TODO: imeplement timeout... how??
-	r = write(uhid_teensy_fd, buf, len);
-	if (r == len)
-		return 1;
+	teensy_retry_start(&retry, timeout);
+	do {
+		r = write(dev->fd, buf, len);
+		if (r == len)
+			return 1;
+	} while (teensy_retry(&retry, classify(r < 0 ? errno : EIO)) == TEENSY_RETRY);
 	return 0;
 }
 
-void teensy_close(void)
+void teensy_close_device(struct teensy_device* dev)
 {
-	if (uhid_teensy_fd >= 0) {
-		close(uhid_teensy_fd);
-		uhid_teensy_fd = -1;
-	}
+	close(dev->fd);
+	free(dev);
 }
 
 int hard_reboot(void)
 {
 	int r, rebootor_fd;
 
-	rebootor_fd = open_usb_device(0x16C0, 0x0477);
+	rebootor_fd = open_usb_device(0x16C0, 0x0477, NULL);
 	if (rebootor_fd < 0)
 		return 0;
 	r = write(rebootor_fd, "reboot", 6);
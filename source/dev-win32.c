@@ -31,8 +31,27 @@
 #include <hidclass.h>
 #include <hidsdi.h>
 #include <setupapi.h>
+#include <stdlib.h>
+#include <string.h>
 
-HANDLE open_usb_device(int vid, int pid)
+// reads the serial number string, empty if the device has none
+static void device_serial(HANDLE h, char* buf, int size)
+{
+	WCHAR wbuf[64];
+	int   i;
+
+	buf[0] = '\0';
+	if (!HidD_GetSerialNumberString(h, wbuf, sizeof(wbuf)))
+		return;
+	wbuf[63] = 0;
+	for (i = 0; wbuf[i] && i < size - 1; i++)
+		buf[i] = wbuf[i] < 128 ? (char)wbuf[i] : '?';
+	buf[i] = '\0';
+}
+
+// calls func for every selected vid/pid device, stops when it returns
+// non-zero
+static HANDLE find_devices(int vid, int pid, int (*func)(const char* path, const char* serial, HANDLE h, void* arg), void* arg)
 {
 	GUID                             guid;
 	HDEVINFO                         info;
@@ -42,6 +61,7 @@ HANDLE open_usb_device(int vid, int pid)
 	HIDD_ATTRIBUTES                  attrib;
 	HANDLE                           h;
 	BOOL                             ret;
+	char                             serial[64];
 
 	HidD_GetHidGuid(&guid);
 	info = SetupDiGetClassDevs(&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
@@ -65,41 +85,61 @@ HANDLE open_usb_device(int vid, int pid)
 			free(details);
 			continue;
 		}
+		if (!teensy_port_selected(pid, details->DevicePath)) {
+			free(details);
+			continue;
+		}
 		h = CreateFile(details->DevicePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
-		free(details);
-		if (h == INVALID_HANDLE_VALUE)
+		if (h == INVALID_HANDLE_VALUE) {
+			free(details);
 			continue;
+		}
 		attrib.Size = sizeof(HIDD_ATTRIBUTES);
 		ret         = HidD_GetAttributes(h, &attrib);
-		if (!ret) {
+		if (!ret || attrib.VendorID != vid || attrib.ProductID != pid) {
+			free(details);
 			CloseHandle(h);
 			continue;
 		}
-		if (attrib.VendorID != vid || attrib.ProductID != pid) {
+		device_serial(h, serial, sizeof(serial));
+		if (!teensy_serial_selected(pid, serial)) {
+			free(details);
 			CloseHandle(h);
 			continue;
 		}
-		SetupDiDestroyDeviceInfoList(info);
-		return h;
+		ret = func(details->DevicePath, serial, h, arg);
+		free(details);
+		if (ret) {
+			SetupDiDestroyDeviceInfoList(info);
+			return h;
+		}
+		CloseHandle(h);
 	}
 	return NULL;
 }
 
-int write_usb_device(HANDLE h, void* buf, int len, int timeout)
+static int open_handle(const char* path, const char* serial, HANDLE h, void* arg)
+{
+	return arg == NULL || strcmp(path, (const char*)arg) == 0;
+}
+
+// opens the first vid/pid device, or the one at path if it isn't NULL
+HANDLE open_usb_device(int vid, int pid, const char* path)
+{
+	return find_devices(vid, pid, open_handle, (void*)path);
+}
+
+int write_usb_device(HANDLE h, HANDLE event, void* buf, int len, int timeout)
 {
-	static HANDLE event = NULL;
 	unsigned char tmpbuf[1089];
 	OVERLAPPED    ov;
 	DWORD         n, r;
 
-	if (len > sizeof(tmpbuf) - 1)
+	if (len > sizeof(tmpbuf) - 1) {
+		SetLastError(ERROR_INVALID_PARAMETER);
 		return 0;
-	if (event == NULL) {
-		event = CreateEvent(NULL, TRUE, TRUE, NULL);
-		if (!event)
-			return 0;
 	}
-	ResetEvent(&event);
+	ResetEvent(event);
 	memset(&ov, 0, sizeof(ov));
 	ov.hEvent = event;
 	tmpbuf[0] = 0;
@@ -110,6 +150,7 @@ int write_usb_device(HANDLE h, void* buf, int len, int timeout)
 		r = WaitForSingleObject(event, timeout);
 		if (r == WAIT_TIMEOUT) {
 			CancelIo(h);
+			SetLastError(ERROR_TIMEOUT);
 			return 0;
 		}
 		if (r != WAIT_OBJECT_0)
@@ -132,54 +173,110 @@ void print_win32_err(void)
 	printf("err %ld: %s\n", err, buf);
 }
 
-static HANDLE win32_teensy_handle = NULL;
+struct list_state {
+	struct teensy_info* list;
+	int                 max;
+	int                 count;
+};
 
-int teensy_open(void)
+static int list_handle(const char* path, const char* serial, HANDLE h, void* arg)
 {
-	teensy_close();
-	win32_teensy_handle = open_usb_device(0x16C0, 0x0478);
-	if (win32_teensy_handle)
-		return 1;
-	return 0;
+	struct list_state* state = (struct list_state*)arg;
+
+	if (strlen(path) >= sizeof(state->list[0].path))
+		return 0;
+	strcpy(state->list[state->count].path, path);
+	snprintf(state->list[state->count].serial, sizeof(state->list[0].serial), "%s", serial);
+	return ++state->count >= state->max;
 }
 
-int teensy_write(void* buf, int len, double timeout)
+int teensy_list(struct teensy_info* list, int max)
 {
-	int      r;
-	uint32_t begin, now, total;
+	struct list_state state = {list, max, 0};
+	HANDLE            h;
 
-	if (!win32_teensy_handle)
+	if (max <= 0)
 		return 0;
-	total = (uint32_t)(timeout * 1000.0);
-	begin = timeGetTime();
-	now   = begin;
+	h = find_devices(0x16C0, 0x0478, list_handle, &state);
+	if (h)
+		CloseHandle(h);
+	return state.count;
+}
+
+struct teensy_device {
+	HANDLE handle;
+	HANDLE event;
+};
+
+struct teensy_device* teensy_open_device(const struct teensy_info* info)
+{
+	struct teensy_device* dev;
+
+	dev = (struct teensy_device*)malloc(sizeof(*dev));
+	if (!dev)
+		return NULL;
+	dev->event = CreateEvent(NULL, TRUE, TRUE, NULL);
+	if (!dev->event) {
+		free(dev);
+		return NULL;
+	}
+	dev->handle = open_usb_device(0x16C0, 0x0478, info ? info->path : NULL);
+	if (!dev->handle) {
+		CloseHandle(dev->event);
+		free(dev);
+		return NULL;
+	}
+	return dev;
+}
+
+static enum teensy_error classify(DWORD err)
+{
+	switch (err) {
+	case ERROR_DEVICE_NOT_CONNECTED:
+	case ERROR_DEVICE_REMOVED:
+	case ERROR_FILE_NOT_FOUND:
+	case ERROR_INVALID_HANDLE:
+	case ERROR_INVALID_PARAMETER:
+		return TEENSY_ABORT; // unplugged, or a report HalfKay can't take
+	default:
+		return TEENSY_RETRY; // stalled, timed out or busy erasing
+	}
+}
+
+int teensy_write_device(struct teensy_device* dev, void* buf, int len, double timeout)
+{
+	struct teensy_retry retry;
+
+	teensy_retry_start(&retry, timeout);
 	do {
-		r = write_usb_device(win32_teensy_handle, buf, len, total - (now - begin));
-		if (r > 0)
+		if (write_usb_device(dev->handle, dev->event, buf, len, (int)(teensy_retry_left(&retry) * 1000.0) + 1) > 0)
 			return 1;
-		Sleep(10);
-		now = timeGetTime();
-	} while (now - begin < total);
+	} while (teensy_retry(&retry, classify(GetLastError())) == TEENSY_RETRY);
 	return 0;
 }
 
-void teensy_close(void)
+void teensy_close_device(struct teensy_device* dev)
 {
-	if (!win32_teensy_handle)
-		return;
-	CloseHandle(win32_teensy_handle);
-	win32_teensy_handle = NULL;
+	CloseHandle(dev->handle);
+	CloseHandle(dev->event);
+	free(dev);
 }
 
 int hard_reboot(void)
 {
-	HANDLE rebootor;
+	HANDLE rebootor, event;
 	int    r;
 
-	rebootor = open_usb_device(0x16C0, 0x0477);
+	rebootor = open_usb_device(0x16C0, 0x0477, NULL);
 	if (!rebootor)
 		return 0;
-	r = write_usb_device(rebootor, "reboot", 6, 100);
+	event = CreateEvent(NULL, TRUE, TRUE, NULL);
+	if (!event) {
+		CloseHandle(rebootor);
+		return 0;
+	}
+	r = write_usb_device(rebootor, event, "reboot", 6, 100);
+	CloseHandle(event);
 	CloseHandle(rebootor);
 	return r;
 }
@@ -0,0 +1,309 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "dev.h"
+#include "stats.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "misc.h"
+#include "record.h"
+#include "thread.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// as many devices as are programmed at the same time
+#define LIST_SIZE 64
+
+/****************************************************************/
+/*                                                              */
+/*                  USB Access - Single Device                  */
+/*                                                              */
+/****************************************************************/
+
+static struct teensy_device* default_device = NULL;
+static struct teensy_info    default_info;
+
+// opens the first listed device that can be opened, and remembers which
+// one it was so it can be found again by teensy_reopen()
+int teensy_open(void)
+{
+	struct teensy_info list[LIST_SIZE];
+	double             begin;
+	int                count, i;
+
+	teensy_close();
+	begin = stats_begin();
+	count = teensy_list(list, LIST_SIZE);
+	for (i = 0; i < count && !default_device; i++) {
+		default_device = teensy_open_device(&list[i]);
+		if (default_device)
+			default_info = list[i];
+	}
+	stats_end(STATS_ENUMERATE, begin);
+	if (!default_device)
+		return 0;
+	record_device(default_device, &default_info);
+	return 1;
+}
+
+struct teensy_device* teensy_device(void)
+{
+	return default_device;
+}
+
+const struct teensy_info* teensy_device_info(void)
+{
+	return default_device ? &default_info : NULL;
+}
+
+int teensy_write(void* buf, int len, double timeout)
+{
+	if (!default_device)
+		return 0;
+	return teensy_write_device(default_device, buf, len, timeout);
+}
+
+void teensy_close(void)
+{
+	if (!default_device)
+		return;
+	teensy_close_device(default_device);
+	default_device = NULL;
+}
+
+#if defined(WIN32)
+static SRWLOCK reopen_lock = SRWLOCK_INIT;
+#define lock()   AcquireSRWLockExclusive(&reopen_lock)
+#define unlock() ReleaseSRWLockExclusive(&reopen_lock)
+#else
+static pthread_mutex_t reopen_lock = PTHREAD_MUTEX_INITIALIZER;
+#define lock()   pthread_mutex_lock(&reopen_lock)
+#define unlock() pthread_mutex_unlock(&reopen_lock)
+#endif
+
+// the same board, also after it came back on a new path
+static int same_device(const struct teensy_info* a, const struct teensy_info* b)
+{
+	if (strcmp(a->path, b->path) == 0)
+		return 1;
+	return a->serial[0] && strcmp(a->serial, b->serial) == 0;
+}
+
+struct teensy_device* teensy_reopen(struct teensy_device* dev, const struct teensy_info* info, double timeout)
+{
+	struct teensy_info    list[LIST_SIZE], found;
+	struct teensy_device* opened   = NULL;
+	double                deadline = monotonic_time() + timeout;
+	int                   count, i;
+
+	teensy_close_device(dev);
+	while (!opened) {
+		lock();
+		count = teensy_list(list, LIST_SIZE);
+		for (i = 0; i < count && !opened; i++) {
+			// a different board must never get blocks without its erase
+			if (info ? same_device(&list[i], info) : count == 1)
+				opened = teensy_open_device(&list[i]);
+			if (opened)
+				found = list[i];
+		}
+		unlock();
+		if (opened || monotonic_time() >= deadline)
+			break;
+		delay(0.1);
+	}
+	if (opened)
+		record_device(opened, &found);
+	if (dev == default_device) {
+		default_device = opened;
+		if (opened)
+			default_info = found;
+	}
+	return opened;
+}
+
+void teensy_lock(void)
+{
+	lock();
+}
+
+void teensy_unlock(void)
+{
+	unlock();
+}
+
+/****************************************************************/
+/*                                                              */
+/*                      Device Selection                        */
+/*                                                              */
+/****************************************************************/
+
+static THREAD_LOCAL char select_port[256];
+static THREAD_LOCAL char select_serial[64];
+static THREAD_LOCAL int  serial_pinned; // select_serial was set by teensy_pin()
+
+void teensy_select(const char* port, const char* serial)
+{
+	snprintf(select_port, sizeof(select_port), "%s", port ? port : "");
+	snprintf(select_serial, sizeof(select_serial), "%s", serial ? serial : "");
+	serial_pinned = 0;
+}
+
+// after a soft reboot, only accept the bootloader of the board that
+// was rebooted. Selectors given by the user are kept.
+void teensy_pin(const char* port, const char* serial)
+{
+	if (port && *port && !select_port[0])
+		snprintf(select_port, sizeof(select_port), "%s", port);
+	if (serial && *serial && !select_serial[0]) {
+		snprintf(select_serial, sizeof(select_serial), "%s", serial);
+		serial_pinned = 1;
+	}
+}
+
+// the rebootor is never selected against, there's only one
+static int selectable(int pid)
+{
+	return pid == 0x0478 || pid == 0x0483;
+}
+
+int teensy_port_selected(int pid, const char* port)
+{
+	if (!selectable(pid) || !select_port[0])
+		return 1;
+	return port && strcmp(port, select_port) == 0;
+}
+
+int teensy_serial_needed(int pid)
+{
+	return selectable(pid) && select_serial[0];
+}
+
+// Teensyduino shows the serial number in decimal. HalfKay on Teensy
+// 3.x and 4.x reports it in hex, and without the extra digit that
+// Teensyduino appends to numbers below 10000000. Both match.
+int teensy_serial_selected(int pid, const char* serial)
+{
+	unsigned long long want, have;
+	char*              end;
+
+	if (!teensy_serial_needed(pid))
+		return 1;
+	// HalfKay on Teensy 2.0 and Teensy++ 2.0 has no serial number, so
+	// the one of the sketch that was rebooted can't rule it out
+	if (!serial || !*serial)
+		return serial_pinned && pid == 0x0478;
+	if (strcmp(serial, select_serial) == 0)
+		return 1;
+	want = strtoull(select_serial, &end, 10);
+	if (*end)
+		return 0;
+	have = strtoull(serial, &end, pid == 0x0478 ? 16 : 10);
+	if (*end || end == serial)
+		return 0;
+	if (pid == 0x0478 && have < 10000000)
+		have *= 10;
+	return have == want;
+}
+
+/****************************************************************/
+/*                                                              */
+/*                        Write Retries                         */
+/*                                                              */
+/****************************************************************/
+
+#define BACKOFF_MIN 0.001 // first wait after a failed attempt
+#define BACKOFF_MAX 0.02  // the wait doubles up to this
+#define MAX_REOPENS 3     // per write, then the device counts as gone
+
+static THREAD_LOCAL enum teensy_error last_error = TEENSY_TIMEOUT;
+
+void teensy_retry_start(struct teensy_retry* retry, double timeout)
+{
+	retry->deadline = monotonic_time() + timeout;
+	retry->wait     = 0.0;
+	retry->backoff  = BACKOFF_MIN;
+	retry->reopens  = 0;
+}
+
+// time left for the next attempt, never 0 since some backends read
+// that as no timeout at all
+double teensy_retry_left(const struct teensy_retry* retry)
+{
+	double left = retry->deadline - monotonic_time();
+
+	return left > 0.001 ? left : 0.001;
+}
+
+enum teensy_error teensy_retry_next(struct teensy_retry* retry, enum teensy_error error)
+{
+	if (error == TEENSY_REOPEN && ++retry->reopens > MAX_REOPENS)
+		error = TEENSY_ABORT;
+	if (error == TEENSY_RETRY) {
+		retry->wait    = retry->backoff;
+		retry->backoff = retry->backoff * 2 < BACKOFF_MAX ? retry->backoff * 2 : BACKOFF_MAX;
+		// waiting only to fail at the deadline is pointless
+		if (monotonic_time() + retry->wait >= retry->deadline)
+			error = TEENSY_TIMEOUT;
+	}
+	if (error == TEENSY_RETRY || error == TEENSY_REOPEN)
+		stats_add(STATS_RETRIES, 1);
+	else
+		last_error = error;
+	return error;
+}
+
+// like teensy_retry_next(), but waits before returning TEENSY_RETRY
+enum teensy_error teensy_retry(struct teensy_retry* retry, enum teensy_error error)
+{
+	error = teensy_retry_next(retry, error);
+	if (error == TEENSY_RETRY)
+		delay(retry->wait);
+	return error;
+}
+
+enum teensy_error teensy_write_error(void)
+{
+	return last_error;
+}
+
+// only the single device is written to on the thread that lists devices
+int teensy_can_reopen(const struct teensy_device* dev)
+{
+	return dev == default_device;
+}
+
+const char* teensy_error_name(enum teensy_error error)
+{
+	switch (error) {
+	case TEENSY_RETRY:
+		return "retry";
+	case TEENSY_REOPEN:
+		return "reopen";
+	case TEENSY_ABORT:
+		return "aborted";
+	default:
+		return "timed out";
+	}
+}
@@ -16,9 +16,100 @@
  * along with this program.  If not, see http://www.gnu.org/licenses/
  */
 
-// USB Access Functions
-int  teensy_open(void);
-int  teensy_write(void* buf, int len, double timeout);
-void teensy_close(void);
-int  hard_reboot(void);
-int  soft_reboot(void);
\ No newline at end of file
+// A HalfKay device found by teensy_list(). path tells it apart from
+// every other device attached to this host, serial is empty if the
+// backend couldn't read it without opening the device.
+struct teensy_info {
+	char path[256];
+	char serial[64];
+};
+
+// An open HalfKay device. Different devices may be written to from
+// different threads at the same time, listing and opening devices is
+// only done from one thread, except through teensy_reopen() or while
+// holding teensy_lock().
+struct teensy_device;
+
+// USB Access Functions, implemented by each backend
+int                   teensy_list(struct teensy_info* list, int max);
+struct teensy_device* teensy_open_device(const struct teensy_info* info);
+int                   teensy_write_device(struct teensy_device* dev, void* buf, int len, double timeout);
+void                  teensy_close_device(struct teensy_device* dev);
+int                   hard_reboot(void);
+int                   soft_reboot(void);
+
+// Single device access, uses the first device found (dev.c)
+// teensy_device_info() tells which one that was, NULL until it's open.
+int                       teensy_open(void);
+struct teensy_device*     teensy_device(void);
+const struct teensy_info* teensy_device_info(void);
+int                       teensy_write(void* buf, int len, double timeout);
+void                      teensy_close(void);
+
+// Reopening (dev.c)
+// Closes dev and waits up to timeout for the same device to be listed
+// again by HalfKay, then opens it. info tells which device that is, it
+// is found again by its path or, if the path changed, its serial
+// number. When NULL it's only reopened if it is the one HalfKay device
+// listed, given the port and serial selected. Several threads may
+// reopen their devices at the same time, they list one at a time.
+// Reopening the single device keeps teensy_device() up to date. Returns
+// NULL if the device didn't come back.
+// Threads that list, open or reboot devices while others may reopen
+// theirs hold teensy_lock(), the lock teensy_reopen() lists under.
+struct teensy_device* teensy_reopen(struct teensy_device* dev, const struct teensy_info* info, double timeout);
+void                  teensy_lock(void);
+void                  teensy_unlock(void);
+
+// Device Selection (dev.c)
+// Restricts HalfKay (16C0:0478) and Teensyduino serial (16C0:0483)
+// devices to the given port and/or serial number, NULL allows any.
+// Backends check the port and serial while enumerating, so devices
+// that aren't selected are never opened unless the serial number has
+// to be read from the device. Each thread has its own selection.
+void teensy_select(const char* port, const char* serial);
+void teensy_pin(const char* port, const char* serial);
+int  teensy_port_selected(int pid, const char* port);
+int  teensy_serial_needed(int pid);
+int  teensy_serial_selected(int pid, const char* serial);
+
+// Write Retries (dev.c)
+// Backends classify every failed attempt at a write and hand it to
+// teensy_retry(), which decides the next step against a monotonic
+// deadline: TEENSY_RETRY after waiting a growing backoff, TEENSY_REOPEN
+// to open the device again first, or TEENSY_ABORT / TEENSY_TIMEOUT once
+// the write has failed. teensy_retry_next() doesn't wait, it leaves the
+// wait in retry->wait. teensy_write_error() tells how the calling
+// thread's last failed write ended.
+// Reopening in place lists devices, which only the thread writing to
+// the single device may do, so backends ask teensy_can_reopen() first
+// and abort the write otherwise.
+enum teensy_error {
+	TEENSY_RETRY,   // stalled or busy erasing, try again
+	TEENSY_REOPEN,  // the handle stopped working, the device may be back
+	TEENSY_ABORT,   // unplugged, or a report the device will never take
+	TEENSY_TIMEOUT, // still failing when the deadline passed
+};
+
+struct teensy_retry {
+	double deadline;
+	double wait;    // before the next attempt
+	double backoff; // wait after the next failure
+	int    reopens;
+};
+
+void              teensy_retry_start(struct teensy_retry* retry, double timeout);
+double            teensy_retry_left(const struct teensy_retry* retry);
+enum teensy_error teensy_retry_next(struct teensy_retry* retry, enum teensy_error error);
+enum teensy_error teensy_retry(struct teensy_retry* retry, enum teensy_error error);
+enum teensy_error teensy_write_error(void);
+int               teensy_can_reopen(const struct teensy_device* dev);
+const char*       teensy_error_name(enum teensy_error error);
+
+#if defined(USE_LIBUSB1)
+// Asynchronous writes, teensy_write_device() is built on top of these.
+// The callback gets 1 if the device accepted the data, or 0 on failure.
+typedef void (*teensy_write_callback)(void* arg, int result);
+int  teensy_write_async(struct teensy_device* dev, void* buf, int len, double timeout, teensy_write_callback callback, void* arg);
+void teensy_handle_events(struct teensy_device* dev, double timeout);
+#endif
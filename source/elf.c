@@ -0,0 +1,100 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "elf.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "ihex.h"
+#include "image.h"
+#include "param.h"
+
+/****************************************************************/
+/*                                                              */
+/*                      Read ELF32 Firmware                     */
+/*                                                              */
+/****************************************************************/
+
+#define ELF_HEADER_SIZE 52
+#define ELF_PHENT_SIZE  32
+#define ELF_CLASS_32    1
+#define ELF_DATA_LSB    1
+#define ELF_PT_LOAD     1
+
+static uint16_t get16(const unsigned char* p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const unsigned char* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int elf_is_file(const char* data, size_t size)
+{
+	return size >= 4 && memcmp(data, "\177ELF", 4) == 0;
+}
+
+/* Segments are loaded by their physical address, which is where the */
+/* linker put the initial contents in flash, even for code and data */
+/* that run from RAM. Segments that don't start within the flash, like */
+/* the AVR EEPROM, can't be programmed by HalfKay and are left out. */
+int read_elf_data(const char* data, size_t size, struct image* img)
+{
+	const unsigned char* file = (const unsigned char*)data;
+	const unsigned char* ph;
+	uint32_t             phoff, offset, paddr, filesz;
+	int                  phentsize, phnum, i, bytes = 0;
+
+	if (size < ELF_HEADER_SIZE || !elf_is_file(data, size))
+		return -2;
+	if (file[4] != ELF_CLASS_32 || file[5] != ELF_DATA_LSB) {
+		printf("Warning, only little endian ELF32 files are supported\n");
+		return -2;
+	}
+	phoff     = get32(file + 28);
+	phentsize = get16(file + 42);
+	phnum     = get16(file + 44);
+	if (phnum == 0) {
+		printf("Warning, ELF file has no program headers, it must be linked\n");
+		return -2;
+	}
+	if (phentsize < ELF_PHENT_SIZE || phoff > size || (size - phoff) / phentsize < (size_t)phnum) {
+		printf("Warning, ELF program headers out of range\n");
+		return -2;
+	}
+	for (i = 0; i < phnum; i++) {
+		ph     = file + phoff + (size_t)i * phentsize;
+		offset = get32(ph + 4);
+		paddr  = ihex_flash_addr(get32(ph + 12));
+		filesz = get32(ph + 16);
+		if (get32(ph) != ELF_PT_LOAD || filesz == 0)
+			continue;
+		if (offset > size || size - offset < filesz || (uint64_t)paddr + filesz > 0x100000000ull) {
+			printf("Warning, ELF segment %d out of range\n", i);
+			return -2;
+		}
+		if (code_size > 0 && paddr >= (uint32_t)code_size)
+			continue;
+		if (filesz > INT32_MAX || !image_write(img, paddr, file + offset, (int)filesz))
+			return -2;
+		bytes += (int)filesz;
+	}
+	return bytes;
+}
@@ -0,0 +1,30 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <stddef.h>
+
+struct image;
+
+// ELF Firmware Functions
+// elf_is_file() tells ELF files apart from hex by their magic number.
+// read_elf_data() loads the PT_LOAD segments of an ELF32 file into img
+// at their physical (load) address, the way objcopy would write them to
+// a hex file. Returns the number of bytes loaded, or -2 if the file
+// isn't a little endian ELF32 file or its headers don't fit in it.
+int elf_is_file(const char* data, size_t size);
+int read_elf_data(const char* data, size_t size, struct image* img);
@@ -0,0 +1,214 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "hotplug.h"
+#include "misc.h"
+#include "stats.h"
+
+#if defined(__linux__)
+
+/****************************************************************/
+/*                                                              */
+/*                 Hotplug - Linux kernel uevents               */
+/*                                                              */
+/****************************************************************/
+
+#include <linux/netlink.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// uevents are sent before udev has applied the device permissions,
+// so after an arrival teensy_open() is retried every 10 ms for a while
+#define SETTLE_RETRIES 100
+#define SETTLE_DELAY   0.01
+
+static int hotplug_fd = -1;
+static int settle     = 0;
+
+int hotplug_open(void)
+{
+	struct sockaddr_nl addr;
+	int                size = 1024 * 1024;
+
+	hotplug_close();
+	hotplug_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (hotplug_fd < 0)
+		return 0;
+	setsockopt(hotplug_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1; // kernel events
+	if (bind(hotplug_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		hotplug_close();
+		return 0;
+	}
+	return 1;
+}
+
+enum uevent {
+	UEVENT_OTHER,
+	UEVENT_ARRIVAL,
+	UEVENT_REMOVAL,
+};
+
+// checks if a uevent announces the HalfKay bootloader coming or going,
+// either the USB device itself or the HID device on top of it
+static enum uevent halfkay_event(const char* msg, int len)
+{
+	const char* p;
+	enum uevent action = UEVENT_OTHER;
+	int         match  = 0;
+
+	for (p = msg; p < msg + len; p += strlen(p) + 1) {
+		if (strcmp(p, "ACTION=add") == 0 || strcmp(p, "ACTION=bind") == 0)
+			action = UEVENT_ARRIVAL;
+		else if (strcmp(p, "ACTION=remove") == 0)
+			action = UEVENT_REMOVAL;
+		else if (strncmp(p, "PRODUCT=16c0/478/", 17) == 0)
+			match = 1;
+		else if (strncmp(p, "HID_ID=", 7) == 0 && strstr(p, ":000016C0:00000478"))
+			match = 1;
+	}
+	return match ? action : UEVENT_OTHER;
+}
+
+// reads everything that is queued, there may be many events. Returns 1
+// if HalfKay arrived, and sets *changed if it arrived or left
+static int read_events(int* changed)
+{
+	struct sockaddr_nl addr;
+	struct iovec       iov;
+	struct msghdr      hdr;
+	char               msg[8192];
+	enum uevent        event;
+	int                n, found = 0;
+
+	while (1) {
+		iov.iov_base = msg;
+		iov.iov_len  = sizeof(msg) - 1;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name    = &addr;
+		hdr.msg_namelen = sizeof(addr);
+		hdr.msg_iov     = &iov;
+		hdr.msg_iovlen  = 1;
+		n               = recvmsg(hotplug_fd, &hdr, MSG_DONTWAIT);
+		if (n <= 0)
+			break;
+		if (addr.nl_pid != 0)
+			continue; // only trust the kernel
+		msg[n] = '\0';
+		event  = halfkay_event(msg, n);
+		if (event == UEVENT_ARRIVAL)
+			found = 1;
+		if (event != UEVENT_OTHER)
+			*changed = 1;
+	}
+	if (found)
+		settle = SETTLE_RETRIES;
+	return found;
+}
+
+int hotplug_wait(double timeout)
+{
+	struct pollfd pfd;
+	double        begin = stats_begin();
+	int           r, changed = 0;
+
+	if (hotplug_fd < 0) {
+		delay(timeout);
+		stats_end(STATS_WAIT, begin);
+		return 0;
+	}
+	if (settle > 0) {
+		settle--;
+		delay(SETTLE_DELAY);
+		stats_end(STATS_WAIT, begin);
+		return 1;
+	}
+
+	pfd.fd     = hotplug_fd;
+	pfd.events = POLLIN;
+	r          = poll(&pfd, 1, (int)(timeout * 1000.0));
+	stats_end(STATS_WAIT, begin);
+	if (r <= 0)
+		return 0;
+	return read_events(&changed);
+}
+
+int hotplug_poll_fd(void)
+{
+	return hotplug_fd;
+}
+
+int hotplug_changed(void)
+{
+	int changed = 0;
+
+	if (hotplug_fd >= 0)
+		read_events(&changed);
+	return changed;
+}
+
+void hotplug_close(void)
+{
+	if (hotplug_fd >= 0) {
+		close(hotplug_fd);
+		hotplug_fd = -1;
+	}
+	settle = 0;
+}
+
+#else
+
+/****************************************************************/
+/*                                                              */
+/*                 Hotplug - not supported, polls               */
+/*                                                              */
+/****************************************************************/
+
+int hotplug_open(void)
+{
+	return 0;
+}
+
+int hotplug_wait(double timeout)
+{
+	double begin = stats_begin();
+
+	delay(timeout);
+	stats_end(STATS_WAIT, begin);
+	return 0;
+}
+
+int hotplug_poll_fd(void)
+{
+	return -1;
+}
+
+int hotplug_changed(void)
+{
+	return 0;
+}
+
+void hotplug_close(void)
+{
+}
+
+#endif
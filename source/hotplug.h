@@ -0,0 +1,30 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+// Hotplug Functions
+// hotplug_open() returns 1 if device arrivals can be waited for, else
+// hotplug_wait() just sleeps. hotplug_wait() returns 1 if a HalfKay
+// device may have appeared and teensy_open() should be tried now.
+// hotplug_poll_fd() can be polled together with other descriptors, it
+// is -1 without hotplug events. hotplug_changed() then reads the queued
+// events and returns 1 if a HalfKay device arrived or left.
+int  hotplug_open(void);
+int  hotplug_wait(double timeout);
+int  hotplug_poll_fd(void);
+int  hotplug_changed(void);
+void hotplug_close(void);
@@ -17,9 +17,24 @@
  */
 
 #include "ihex.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "elf.h"
+#include "image.h"
+#include "mapfile.h"
 #include "param.h"
+#include "thread.h"
+#include "uf2.h"
+
+#if defined(WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 /****************************************************************/
 /*                                                              */
@@ -27,190 +42,671 @@
 /*                                                              */
 /****************************************************************/
 
-// the maximum flash image size we can support
-// chips with larger memory may be used, but only this
-// much intel-hex data can be loaded into memory!
-#define MAX_MEMORY_SIZE 0x1000000
+// files smaller than this are always parsed on the calling thread
+#define PARALLEL_MIN_SIZE (1024 * 1024)
+#define MAX_THREADS       64
 
-static unsigned char firmware_image[MAX_MEMORY_SIZE];
-static unsigned char firmware_mask[MAX_MEMORY_SIZE];
-static int           end_record_seen = 0;
-static int           byte_count;
-static unsigned int  extended_addr = 0;
-static int           parse_hex_line(char* line);
+struct ihex_parser {
+	struct image* img;
+	unsigned int  extended_addr;
+	int           end_record_seen;
+	int           byte_count;
+	int           ordered;   // data must not go back below complete
+	int           unordered; // set when it did
+	uint32_t      complete;  // pages below this won't change any more
+};
 
-int read_intel_hex(const char* filename)
+// a line aligned slice of the file, decoded by one thread
+struct ihex_chunk {
+	const char*        begin;
+	const char*        end;
+	int                has_ext; // chunk sets the extended address
+	unsigned int       last_ext;
+	int                lines;      // lines parsed
+	int                error_line; // line within the chunk, 0 if none
+	struct ihex_parser parser;
+	struct image       img;
+};
+
+static struct image firmware;
+
+// identifies the files the image was last read from
+static struct {
+	int               valid; // 0 if it isn't a regular file
+	struct file_stamp stamp;
+	uint64_t          hash;
+} parsed_files[MAX_INPUT_FILES];
+static int parsed_count = 0;
+static int          parse_hex_line(struct ihex_parser* parser, const char* line, int len);
+static int          parse_extended_addr(const char* line, int len, unsigned int* addr);
+
+static const char* next_line(const char* line, const char* end)
+{
+	const char* next = memchr(line, '\n', end - line);
+	return next ? next + 1 : end;
+}
+
+// pre-pass: find the extended address the chunk leaves behind
+static void scan_chunk(void* arg)
+{
+	struct ihex_chunk* chunk = arg;
+	const char*        line;
+	const char*        next;
+	unsigned int       addr;
+
+	for (line = chunk->begin; line < chunk->end; line = next) {
+		next = next_line(line, chunk->end);
+		if (parse_extended_addr(line, (int)(next - line), &addr)) {
+			chunk->has_ext  = 1;
+			chunk->last_ext = addr;
+		}
+	}
+}
+
+static void parse_chunk(void* arg)
+{
+	struct ihex_chunk* chunk = arg;
+	const char*        line;
+	const char*        next;
+
+	for (line = chunk->begin; line < chunk->end; line = next) {
+		next = next_line(line, chunk->end);
+		chunk->lines++;
+		if (parse_hex_line(&chunk->parser, line, (int)(next - line)) == 0) {
+			chunk->error_line = chunk->lines;
+			return;
+		}
+		if (chunk->parser.end_record_seen)
+			return;
+	}
+}
+
+/* Large files are split at line boundaries and decoded by several */
+/* threads. Every data record depends on the last extended address */
+/* record before it, so a quick pre-pass finds the extended address */
+/* each chunk starts with. The chunks are decoded into images of their */
+/* own and merged in file order, which gives the same result as */
+/* parsing the file front to back. */
+static int parse_hex_parallel(const char* data, size_t size, int threads)
+{
+	struct ihex_chunk chunks[MAX_THREADS];
+	struct thread*    workers[MAX_THREADS];
+	const char*       end = data + size;
+	unsigned int      ext = 0;
+	int               i, lineno = 0, byte_count = 0, r = -3;
+
+	memset(chunks, 0, sizeof(chunks));
+	for (i = 0; i < threads; i++) {
+		chunks[i].begin = i ? chunks[i - 1].end : data;
+		chunks[i].end   = i + 1 < threads ? data + size / threads * (i + 1) : end;
+		if (chunks[i].end < chunks[i].begin)
+			chunks[i].end = chunks[i].begin;
+		else if (chunks[i].end < end)
+			chunks[i].end = next_line(chunks[i].end, end);
+	}
+
+	for (i = 0; i < threads; i++)
+		workers[i] = thread_start(scan_chunk, &chunks[i]);
+	for (i = 0; i < threads; i++) {
+		thread_join(workers[i]);
+		chunks[i].parser.img           = &chunks[i].img;
+		chunks[i].parser.extended_addr = ext;
+		if (chunks[i].has_ext)
+			ext = chunks[i].last_ext;
+	}
+
+	for (i = 0; i < threads; i++)
+		workers[i] = thread_start(parse_chunk, &chunks[i]);
+	for (i = 0; i < threads; i++)
+		thread_join(workers[i]);
+
+	for (i = 0; i < threads; i++) {
+		if (r == -3) {
+			byte_count += chunks[i].parser.byte_count;
+			if (chunks[i].error_line) {
+				printf("Warning, HEX parse error line %d\n", lineno + chunks[i].error_line);
+				r = -2;
+			} else if (!image_merge(&firmware, &chunks[i].img)) {
+				printf("Warning, HEX parse error line %d\n", lineno + chunks[i].lines);
+				r = -2;
+			} else if (chunks[i].parser.end_record_seen) {
+				r = byte_count;
+			}
+			lineno += chunks[i].lines;
+		}
+		image_clear(&chunks[i].img);
+	}
+	return r == -3 ? byte_count : r;
+}
+
+static int parse_hex_data(const char* data, size_t size)
+{
+	struct ihex_parser parser;
+	const char*        line;
+	const char*        end;
+	const char*        next;
+	int                threads, lineno = 0;
+
+	threads = parse_threads > 0 ? parse_threads : thread_cpu_count();
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	if (threads > 1 && size >= PARALLEL_MIN_SIZE)
+		return parse_hex_parallel(data, size, threads);
+
+	// records are parsed straight from the mapping, one line at a time
+	memset(&parser, 0, sizeof(parser));
+	parser.img = &firmware;
+	end        = data + size;
+	for (line = data; line < end; line = next) {
+		next = next_line(line, end);
+		lineno++;
+		if (parse_hex_line(&parser, line, (int)(next - line)) == 0) {
+			printf("Warning, HEX parse error line %d\n", lineno);
+			return -2;
+		}
+		if (parser.end_record_seen)
+			break;
+	}
+	return parser.byte_count;
+}
+
+// true for file names ending in .bin, in any case
+static int bin_file_name(const char* name)
+{
+	size_t len = name ? strlen(name) : 0;
+
+	return len >= 4 && name[len - 4] == '.' && (name[len - 3] | 0x20) == 'b' && (name[len - 2] | 0x20) == 'i' && (name[len - 1] | 0x20) == 'n';
+}
+
+/* ELF and UF2 files are told apart from hex by their magic numbers, */
+/* raw binaries by their name. Binaries are copied to --base-address */
+/* as they are, going through the FlexSPI mapping like hex addresses. */
+static int parse_file_data(const char* name, const char* data, size_t size)
 {
-	FILE* fp;
-	int   i, lineno = 0;
-	char  buf[1024];
+	uint32_t addr = ihex_flash_addr(base_address);
 
-	byte_count      = 0;
-	end_record_seen = 0;
-	for (i = 0; i < MAX_MEMORY_SIZE; i++) {
-		firmware_image[i] = 0xFF;
-		firmware_mask[i]  = 0;
+	if (elf_is_file(data, size))
+		return read_elf_data(data, size, &firmware);
+	if (uf2_is_file(data, size))
+		return read_uf2_data(data, size, &firmware);
+	if (!bin_file_name(name))
+		return parse_hex_data(data, size);
+	if (size > INT32_MAX || (uint64_t)addr + size > 0x100000000ull || !image_write(&firmware, addr, (const unsigned char*)data, (int)size)) {
+		printf("Warning, binary file doesn't fit at 0x%08X\n", base_address);
+		return -2;
 	}
-	extended_addr = 0;
+	return (int)size;
+}
 
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
+// reads one file into the image, remembering what it looked like in
+// parsed_files[slot]
+static int read_file(const char* filename, int slot)
+{
+	struct mapped_file file;
+	struct file_stamp  stamp;
+	int                regular;
+	int                r;
+
+	parsed_count             = 0;
+	parsed_files[slot].valid = 0;
+	if (strcmp(filename, "-") == 0)
+		return read_intel_hex_stream(stdin);
+	image_clear(&firmware);
+	regular = stat_file(filename, &stamp);
+	if (!map_file(filename, &file)) {
 		//printf("Unable to read file %s\n", filename);
 		return -1;
 	}
-	while (!feof(fp)) {
-		*buf = '\0';
-		if (!fgets(buf, sizeof(buf), fp))
+	r = parse_file_data(filename, file.data, file.size);
+	if (r >= 0 && regular) {
+		parsed_files[slot].valid = 1;
+		parsed_files[slot].stamp = stamp;
+		parsed_files[slot].hash  = hash_data(file.data, file.size);
+	}
+	unmap_file(&file);
+	return r;
+}
+
+int read_intel_hex(const char* filename)
+{
+	return read_intel_hex_files(&filename, 1);
+}
+
+/* Several files are read one after another and merged into a single */
+/* image, so the chip is erased once and every block is written in one */
+/* pass. No byte may come from more than one file. Each file's ranges */
+/* are listed once and checked against the files before it, which is */
+/* far less work than comparing the byte masks of the images. */
+int read_intel_hex_files(const char* const* filenames, int count)
+{
+	struct image        merged = {0};
+	struct image_ranges ranges[MAX_INPUT_FILES];
+	uint32_t            addr;
+	int                 i, j, r, bytes = 0;
+
+	if (count == 1) {
+		r            = read_file(filenames[0], 0);
+		parsed_count = r >= 0;
+		return r;
+	}
+	if (count < 1 || count > MAX_INPUT_FILES)
+		return -1;
+	memset(ranges, 0, sizeof(ranges));
+	for (i = 0; i < count && bytes >= 0; i++) {
+		r = read_file(filenames[i], i);
+		if (r < 0 || !image_get_ranges(&firmware, &ranges[i])) {
+			bytes = r < 0 ? r : -1;
 			break;
-		lineno++;
-		if (*buf) {
-			if (parse_hex_line(buf) == 0) {
-				printf("Warning, HEX parse error line %d\n", lineno);
-				return -2;
+		}
+		for (j = 0; j < i; j++) {
+			if (image_ranges_overlap(&ranges[j], &ranges[i], &addr)) {
+				printf("Warning, \"%s\" overlaps \"%s\" at 0x%08X\n", filenames[i], filenames[j], addr);
+				bytes = -2;
+				break;
 			}
 		}
-		if (end_record_seen)
+		if (bytes >= 0 && !image_merge(&merged, &firmware))
+			bytes = -1;
+		if (bytes >= 0)
+			bytes += r;
+	}
+	for (i = 0; i < count; i++)
+		image_ranges_clear(&ranges[i]);
+	image_clear(&firmware);
+	if (bytes < 0) {
+		image_clear(&merged);
+		return bytes;
+	}
+	firmware     = merged;
+	parsed_count = count;
+	return bytes;
+}
+
+/* parses a file that is already in memory, like read_intel_hex(). */
+/* name is only used to recognise raw binaries, it may be NULL */
+int read_intel_hex_data(const char* name, const char* data, size_t size)
+{
+	image_clear(&firmware);
+	parsed_count = 0;
+	return parse_file_data(name, data, size);
+}
+
+/****************************************************************/
+/*                                                              */
+/*                   Streaming Intel Hex Input                  */
+/*                                                              */
+/****************************************************************/
+
+#define STREAM_CHUNK    65536
+#define STREAM_LINE_MAX (11 + 255 * 2 + 2) // longest record, with CR LF
+
+// how far the input has been read. Not done to begin with, so a thread
+// that asks before read_intel_hex_stream() got going waits for it
+static struct {
+	int      done;   // the input ended, or couldn't be parsed
+	int      failed; // it couldn't be parsed
+	uint32_t complete;
+} stream;
+
+#if defined(WIN32)
+static SRWLOCK            stream_lock    = SRWLOCK_INIT;
+static CONDITION_VARIABLE stream_changed = CONDITION_VARIABLE_INIT;
+#define lock()           AcquireSRWLockExclusive(&stream_lock)
+#define unlock()         ReleaseSRWLockExclusive(&stream_lock)
+#define wait_for_input() SleepConditionVariableSRW(&stream_changed, &stream_lock, INFINITE, 0)
+#define input_changed()  WakeAllConditionVariable(&stream_changed)
+#else
+static pthread_mutex_t stream_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  stream_changed = PTHREAD_COND_INITIALIZER;
+#define lock()           pthread_mutex_lock(&stream_lock)
+#define unlock()         pthread_mutex_unlock(&stream_lock)
+#define wait_for_input() pthread_cond_wait(&stream_changed, &stream_lock)
+#define input_changed()  pthread_cond_broadcast(&stream_changed)
+#endif
+
+// reads whatever input has arrived, up to size bytes, and only blocks
+// while there is none. fread() would wait for a whole chunk, holding
+// back records the producer already wrote. Returns 0 at the end of the
+// input, or -1 on errors
+static int read_input(FILE* fp, char* buf, int size)
+{
+#if defined(WIN32)
+	return _read(_fileno(fp), buf, size);
+#else
+	ssize_t n;
+
+	do {
+		n = read(fileno(fp), buf, size);
+	} while (n < 0 && errno == EINTR);
+	return (int)n;
+#endif
+}
+
+/* Hex read from a pipe is parsed in chunks as it arrives, instead of */
+/* reading it all first. Records have to come in address order, so a */
+/* record at some address means every page below it is complete and */
+/* can be written while the rest is still being produced. */
+int read_intel_hex_stream(FILE* fp)
+{
+	static char        buf[STREAM_LINE_MAX + STREAM_CHUNK];
+	struct ihex_parser parser;
+	const char*        line;
+	const char*        next;
+	const char*        end;
+	size_t             kept = 0;
+	int                n, lineno = 0, r = 0;
+
+	lock();
+	image_clear(&firmware);
+	stream.done     = 0;
+	stream.failed   = 0;
+	stream.complete = 0;
+	unlock();
+	memset(&parser, 0, sizeof(parser));
+	parser.img     = &firmware;
+	parser.ordered = 1;
+	do {
+		n = read_input(fp, buf + kept, STREAM_CHUNK);
+		if (n < 0) {
+			r = -1;
 			break;
-		if (feof(stdin))
+		}
+		end = buf + kept + n;
+		lock();
+		for (line = buf; line < end && !parser.end_record_seen; line = next) {
+			next = memchr(line, '\n', end - line);
+			if (!next && n > 0)
+				break; // the rest of the line is still to come
+			next = next ? next + 1 : end;
+			lineno++;
+			if (parse_hex_line(&parser, line, (int)(next - line)) == 0) {
+				if (parser.unordered)
+					printf("Warning, HEX records out of address order can't be streamed, line %d\n", lineno);
+				else
+					printf("Warning, HEX parse error line %d\n", lineno);
+				r = -2;
+				break;
+			}
+		}
+		stream.complete = parser.complete;
+		input_changed();
+		unlock();
+		kept = end - line;
+		memmove(buf, line, kept);
+		if (r == 0 && kept > STREAM_LINE_MAX) {
+			printf("Warning, HEX parse error line %d\n", lineno + 1);
+			r = -2;
+		}
+	} while (n > 0 && r == 0 && !parser.end_record_seen);
+	lock();
+	stream.done   = 1;
+	stream.failed = r < 0;
+	input_changed();
+	unlock();
+	return r < 0 ? r : parser.byte_count;
+}
+
+int ihex_stream_wait(uint32_t end)
+{
+	int r;
+
+	lock();
+	while (!stream.done && stream.complete < end)
+		wait_for_input();
+	r = !stream.failed;
+	unlock();
+	return r;
+}
+
+int ihex_stream_next_block(uint32_t addr, uint32_t block_size, uint32_t* next)
+{
+	int found;
+
+	lock();
+	while (1) {
+		found = image_next_block(&firmware, addr, block_size, next);
+		if (stream.done || (found && *next + block_size <= stream.complete))
 			break;
+		wait_for_input();
 	}
-	fclose(fp);
-	return byte_count;
+	found = found && !stream.failed;
+	unlock();
+	return found;
+}
+
+void ihex_stream_get_data(uint32_t addr, int len, unsigned char* bytes)
+{
+	lock();
+	image_get_data(&firmware, addr, len, bytes);
+	unlock();
+}
+
+/* the image read by read_intel_hex() */
+const struct image* ihex_image(void)
+{
+	return &firmware;
+}
+
+/* exchanges the parsed image with img, so images can be kept around */
+/* and programmed again without parsing their files again */
+void ihex_swap_image(struct image* img)
+{
+	struct image tmp = firmware;
+
+	firmware     = *img;
+	*img         = tmp;
+	parsed_count = 0;
+}
+
+static int file_changed(const char* filename, int slot)
+{
+	struct mapped_file file;
+	struct file_stamp  stamp;
+	int                changed;
+
+	if (!parsed_files[slot].valid || !stat_file(filename, &stamp))
+		return 1;
+	if (stamp.size != parsed_files[slot].stamp.size || stamp.mtime != parsed_files[slot].stamp.mtime)
+		return 1;
+	// same size and time stamp, but it could have been rewritten
+	// within the timestamp resolution, so compare the contents too
+	if (!map_file(filename, &file))
+		return 1;
+	changed = hash_data(file.data, file.size) != parsed_files[slot].hash;
+	unmap_file(&file);
+	return changed;
+}
+
+/* returns 0 if filename still has the size, modification time and */
+/* contents it had when read_intel_hex() last read it successfully */
+int ihex_file_changed(const char* filename)
+{
+	return ihex_files_changed(&filename, 1);
+}
+
+/* like ihex_file_changed(), for the files read by read_intel_hex_files() */
+int ihex_files_changed(const char* const* filenames, int count)
+{
+	int i;
+
+	if (count != parsed_count)
+		return 1;
+	for (i = 0; i < count; i++) {
+		if (file_changed(filenames[i], i))
+			return 1;
+	}
+	return 0;
 }
 
 /* from ihex.c, at http://www.pjrc.com/tech/8051/pm2_docs/intel-hex.html */
 
-/* parses a line of intel hex code, stores the data in bytes[] */
-/* and the beginning address in addr, and returns a 1 if the */
-/* line was valid, or a 0 if an error occured.  The variable */
-/* num gets the number of bytes that were stored into bytes[] */
+/* lookup table to convert an ASCII hex digit into its value. Valid */
+/* digits have bit 4 set, so a whole record can be decoded without */
+/* branching and checked for invalid characters once at the end.  */
+
+#define HEX_DIGIT_VALID 0x10
 
-int parse_hex_line(char* line)
+static const unsigned char hex_digit[256] = {
+	['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+	['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+	['A'] = 0x1A, ['B'] = 0x1B, ['C'] = 0x1C, ['D'] = 0x1D, ['E'] = 0x1E, ['F'] = 0x1F,
+	['a'] = 0x1A, ['b'] = 0x1B, ['c'] = 0x1C, ['d'] = 0x1D, ['e'] = 0x1E, ['f'] = 0x1F,
+};
+
+/* decodes count pairs of hex digits from src into dst, adding every */
+/* decoded byte to *sum. Returns 1 if all digits were valid, else 0 */
+
+static int decode_hex(const char* src, unsigned char* dst, int count, unsigned int* sum)
 {
-	int   addr, code, num;
-	int   sum, len, cksum, i;
-	char* ptr;
+	unsigned int valid = HEX_DIGIT_VALID, total = 0, hi, lo;
+	int          i;
 
-	num = 0;
-	if (line[0] != ':')
+	for (i = 0; i < count; i++) {
+		hi     = hex_digit[(unsigned char)src[i * 2]];
+		lo     = hex_digit[(unsigned char)src[i * 2 + 1]];
+		valid &= hi & lo;
+		dst[i] = (unsigned char)(((hi & 15) << 4) | (lo & 15));
+		total += dst[i];
+	}
+	*sum += total;
+	return valid != 0;
+}
+
+/* converts an address in the memory map to an offset into the flash */
+uint32_t ihex_flash_addr(uint32_t addr)
+{
+	if (code_size > 1048576 && block_size >= 1024 && addr >= 0x60000000 && addr < 0x60000000 + (unsigned int)code_size) {
+		// Teensy 4.0 HEX files have 0x60000000 FlexSPI offset
+		addr -= 0x60000000;
+	}
+	return addr;
+}
+
+/* converts the address of an extended address record, applying the */
+/* FlexSPI offset of Teensy 4 hex files */
+static unsigned int extended_addr_value(int code, const unsigned char* record)
+{
+	unsigned int addr;
+
+	if (code == 2) {
+		addr = ((record[0] << 8) | record[1]) << 4;
+		//printf("ext addr = %05X\n", addr);
+	} else {
+		addr = ihex_flash_addr(((record[0] << 8) | record[1]) << 16);
+		//printf("ext addr = %08X\n", addr);
+	}
+	return addr;
+}
+
+/* returns 1 if the line is an extended address record which changes */
+/* the extended address, and stores the new address in *addr */
+static int parse_extended_addr(const char* line, int len, unsigned int* addr)
+{
+	unsigned char record[7];
+	unsigned int  sum = 0;
+
+	if (len < 15 || line[0] != ':' || line[7] != '0' || (line[8] != '2' && line[8] != '4'))
 		return 0;
-	if (strlen(line) < 11)
+	if (!decode_hex(line + 1, record, 7, &sum) || record[0] != 2 || (sum & 255))
 		return 0;
-	ptr = line + 1;
-	if (!sscanf(ptr, "%02x", &len))
+	*addr = extended_addr_value(record[3], record + 4);
+	return 1;
+}
+
+/* parses a line of intel hex code and stores the data in the */
+/* parser's image. Returns a 1 if the line was valid, or a 0 if */
+/* an error occured. The line does not need to be terminated, */
+/* len is the number of characters available in line. */
+
+int parse_hex_line(struct ihex_parser* parser, const char* line, int len)
+{
+	unsigned char record[4 + 256];
+	unsigned int  sum = 0;
+	int           count, addr, code;
+
+	if (line[0] != ':')
 		return 0;
-	ptr += 2;
-	if ((int)strlen(line) < (11 + (len * 2)))
+	if (len < 11)
 		return 0;
-	if (!sscanf(ptr, "%04x", &addr))
+	if (!decode_hex(line + 1, record, 4, &sum))
 		return 0;
-	ptr += 4;
-	/* printf("Line: length=%d Addr=%d\n", len, addr); */
-	if (!sscanf(ptr, "%02x", &code))
+	count = record[0];
+	addr  = (record[1] << 8) | record[2];
+	code  = record[3];
+	if (len < (11 + (count * 2)))
 		return 0;
-	if (addr + extended_addr + len >= MAX_MEMORY_SIZE)
+	if ((uint64_t)addr + parser->extended_addr + count > 0x100000000ull)
 		return 0;
-	ptr += 2;
-	sum = (len & 255) + ((addr >> 8) & 255) + (addr & 255) + (code & 255);
 	if (code != 0) {
 		if (code == 1) {
-			end_record_seen = 1;
+			parser->end_record_seen = 1;
 			return 1;
 		}
-		if (code == 2 && len == 2) {
-			if (!sscanf(ptr, "%04x", &i))
-				return 1;
-			ptr += 4;
-			sum += ((i >> 8) & 255) + (i & 255);
-			if (!sscanf(ptr, "%02x", &cksum))
+		if ((code == 2 || code == 4) && count == 2) {
+			// extended address records with a bad checksum are ignored
+			if (!decode_hex(line + 9, record + 4, 3, &sum))
 				return 1;
-			if (((sum & 255) + (cksum & 255)) & 255)
+			if (sum & 255)
 				return 1;
-			extended_addr = i << 4;
-			//printf("ext addr = %05X\n", extended_addr);
-		}
-		if (code == 4 && len == 2) {
-			if (!sscanf(ptr, "%04x", &i))
-				return 1;
-			ptr += 4;
-			sum += ((i >> 8) & 255) + (i & 255);
-			if (!sscanf(ptr, "%02x", &cksum))
-				return 1;
-			if (((sum & 255) + (cksum & 255)) & 255)
-				return 1;
-			extended_addr = i << 16;
-			if (code_size > 1048576 && block_size >= 1024 && extended_addr >= 0x60000000 && extended_addr < 0x60000000 + code_size) {
-				// Teensy 4.0 HEX files have 0x60000000 FlexSPI offset
-				extended_addr -= 0x60000000;
-			}
-			//printf("ext addr = %08X\n", extended_addr);
+			parser->extended_addr = extended_addr_value(code, record + 4);
 		}
 		return 1; // non-data line
 	}
-	byte_count += len;
-	while (num != len) {
-		if (sscanf(ptr, "%02x", &i) != 1)
-			return 0;
-		i &= 255;
-		firmware_image[addr + extended_addr + num] = i;
-		firmware_mask[addr + extended_addr + num]  = 1;
-		ptr += 2;
-		sum += i;
-		(num)++;
-		if (num >= 256)
-			return 0;
-	}
-	if (!sscanf(ptr, "%02x", &cksum))
+	if (parser->ordered) {
+		if (addr + parser->extended_addr < parser->complete) {
+			parser->unordered = 1;
+			return 0; // the page may have been written already
+		}
+		parser->complete = (addr + parser->extended_addr) & ~(uint32_t)(IMAGE_PAGE_SIZE - 1);
+	}
+	parser->byte_count += count;
+	// decode the data and the checksum in a single pass
+	if (!decode_hex(line + 9, record + 4, count + 1, &sum))
 		return 0;
-	if (((sum & 255) + (cksum & 255)) & 255)
+	if (sum & 255)
 		return 0; /* checksum error */
+	if (!image_write(parser->img, addr + parser->extended_addr, record + 4, count))
+		return 0;
 	return 1;
 }
 
 int ihex_bytes_within_range(int begin, int end)
 {
-	int i;
-
-	if (begin < 0 || begin >= MAX_MEMORY_SIZE || end < 0 || end >= MAX_MEMORY_SIZE) {
+	if (begin < 0 || end < 0) {
 		return 0;
 	}
-	for (i = begin; i <= end; i++) {
-		if (firmware_mask[i])
-			return 1;
-	}
-	return 0;
+	return image_bytes_within_range(&firmware, begin, end);
 }
 
 void ihex_get_data(int addr, int len, unsigned char* bytes)
 {
 	int i;
 
-	if (addr < 0 || len < 0 || addr + len >= MAX_MEMORY_SIZE) {
+	if (addr < 0 || len < 0) {
 		for (i = 0; i < len; i++) {
 			bytes[i] = 255;
 		}
 		return;
 	}
-	for (i = 0; i < len; i++) {
-		if (firmware_mask[addr]) {
-			bytes[i] = firmware_image[addr];
-		} else {
-			bytes[i] = 255;
-		}
-		addr++;
-	}
+	image_get_data(&firmware, addr, len, bytes);
 }
 
 int memory_is_blank(int addr, int block_size)
 {
-	if (addr < 0 || addr > MAX_MEMORY_SIZE)
+	if (addr < 0)
 		return 1;
+	return image_is_blank(&firmware, addr, block_size);
+}
 
-	while (block_size && addr < MAX_MEMORY_SIZE) {
-		if (firmware_mask[addr] && firmware_image[addr] != 255)
-			return 0;
-		addr++;
-		block_size--;
-	}
-	return 1;
+/* returns the address of the next block at or after addr that needs */
+/* to be programmed, or -1 if the rest of the image is blank */
+int ihex_next_block(int addr, int block_size)
+{
+	uint32_t next;
+
+	if (addr < 0 || block_size <= 0)
+		return -1;
+	if (!image_next_block(&firmware, addr, block_size, &next) || next > INT32_MAX)
+		return -1;
+	return (int)next;
 }
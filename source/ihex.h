@@ -16,8 +16,38 @@
  * along with this program.  If not, see http://www.gnu.org/licenses/
  */
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct image;
+
+// most files read_intel_hex_files() merges into one image
+#define MAX_INPUT_FILES 16
+
 // Intel Hex File Functions
-int  read_intel_hex(const char* filename);
-int  ihex_bytes_within_range(int begin, int end);
-void ihex_get_data(int addr, int len, unsigned char* bytes);
-int  memory_is_blank(int addr, int block_size);
+int                 read_intel_hex(const char* filename);
+int                 read_intel_hex_files(const char* const* filenames, int count);
+int                 read_intel_hex_data(const char* name, const char* data, size_t size);
+void                ihex_swap_image(struct image* img);
+const struct image* ihex_image(void);
+int                 ihex_file_changed(const char* filename);
+int                 ihex_files_changed(const char* const* filenames, int count);
+int                 ihex_bytes_within_range(int begin, int end);
+void                ihex_get_data(int addr, int len, unsigned char* bytes);
+int                 memory_is_blank(int addr, int block_size);
+int                 ihex_next_block(int addr, int block_size);
+uint32_t            ihex_flash_addr(uint32_t addr);
+
+// Streaming (ihex.c)
+// read_intel_hex_stream() parses hex as it is read from fp, which
+// read_intel_hex() does for the file name "-" (standard input). While
+// it runs, other threads may wait with ihex_stream_wait() until every
+// byte below end is known, and read the complete part of the image with
+// ihex_stream_next_block() and ihex_stream_get_data(). Both waits return
+// 0 if the input couldn't be parsed. They may be called before the
+// stream is started, but only if it will be.
+int  read_intel_hex_stream(FILE* fp);
+int  ihex_stream_wait(uint32_t end);
+int  ihex_stream_next_block(uint32_t addr, uint32_t block_size, uint32_t* next);
+void ihex_stream_get_data(uint32_t addr, int len, unsigned char* bytes);
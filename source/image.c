@@ -0,0 +1,400 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "image.h"
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************************************/
+/*                                                              */
+/*                     Sparse Firmware Image                    */
+/*                                                              */
+/****************************************************************/
+
+#define PAGE_MASK ((uint32_t)(IMAGE_PAGE_SIZE - 1))
+
+void image_clear(struct image* img)
+{
+	int i;
+
+	for (i = 0; i < img->page_count; i++) {
+		free(img->pages[i]);
+	}
+	free(img->pages);
+	memset(img, 0, sizeof(*img));
+}
+
+// index of the first page whose address is not below addr
+static int find_page(const struct image* img, uint32_t addr)
+{
+	int lo = 0, hi = img->page_count, mid;
+
+	addr &= ~PAGE_MASK;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (img->pages[mid]->addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// inserts page at index i, returns 0 if out of memory
+static int insert_page(struct image* img, int i, struct image_page* page)
+{
+	struct image_page** pages;
+	int                 n;
+
+	if (img->page_count == img->page_alloc) {
+		n     = img->page_alloc ? img->page_alloc * 2 : 64;
+		pages = realloc(img->pages, n * sizeof(*pages));
+		if (pages == NULL)
+			return 0;
+		img->pages      = pages;
+		img->page_alloc = n;
+	}
+	memmove(img->pages + i + 1, img->pages + i, (img->page_count - i) * sizeof(*img->pages));
+	img->pages[i] = page;
+	img->page_count++;
+	img->last = i;
+	return 1;
+}
+
+// index of the page holding addr, or where it would have to be inserted
+static int locate_page(struct image* img, uint32_t addr)
+{
+	int i;
+
+	addr &= ~PAGE_MASK;
+	// hex files are almost always written in ascending order, so
+	// check the page of the previous write and the one after it
+	// before falling back to a binary search
+	i = img->last;
+	if (i < img->page_count && img->pages[i]->addr == addr)
+		return i;
+	if (i + 1 < img->page_count && img->pages[i + 1]->addr == addr)
+		return i + 1;
+	if (img->page_count > 0 && img->pages[img->page_count - 1]->addr < addr)
+		return img->page_count;
+	return find_page(img, addr);
+}
+
+static struct image_page* get_page(struct image* img, uint32_t addr)
+{
+	struct image_page* page;
+	int                i;
+
+	addr &= ~PAGE_MASK;
+	i = locate_page(img, addr);
+	if (i < img->page_count && img->pages[i]->addr == addr) {
+		img->last = i;
+		return img->pages[i];
+	}
+
+	page = malloc(sizeof(*page));
+	if (page == NULL)
+		return NULL;
+	page->addr = addr;
+	memset(page->used, 0, sizeof(page->used));
+	memset(page->nonblank, 0, sizeof(page->nonblank));
+	memset(page->mask, 0, sizeof(page->mask));
+	memset(page->data, 0xFF, sizeof(page->data));
+	if (!insert_page(img, i, page)) {
+		free(page);
+		return NULL;
+	}
+	return page;
+}
+
+/* stores len bytes at addr, returns 1 on success or 0 if out of memory */
+int image_write(struct image* img, uint32_t addr, const unsigned char* data, int len)
+{
+	struct image_page* page;
+	uint32_t           off, bit, chunk;
+	int                n;
+
+	while (len > 0) {
+		page = get_page(img, addr);
+		if (page == NULL)
+			return 0;
+		off = addr & PAGE_MASK;
+		n   = IMAGE_PAGE_SIZE - (int)off;
+		if (n > len)
+			n = len;
+		// keep the chunk counters up to date while copying, so the
+		// programming loop never has to scan the data itself
+		for (bit = off; bit < off + n; bit++) {
+			chunk = bit / IMAGE_CHUNK_SIZE;
+			if (!(page->mask[bit >> 5] & (1u << (bit & 31)))) {
+				page->mask[bit >> 5] |= 1u << (bit & 31);
+				page->used[chunk]++;
+			}
+			page->nonblank[chunk] += (data[bit - off] != 0xFF) - (page->data[bit] != 0xFF);
+			page->data[bit] = data[bit - off];
+		}
+		addr += n;
+		data += n;
+		len -= n;
+	}
+	return 1;
+}
+
+/* returns 1 if any byte between begin and end (inclusive) is present */
+int image_bytes_within_range(const struct image* img, uint32_t begin, uint32_t end)
+{
+	const struct image_page* page;
+	uint32_t                 bit, first, last;
+	int                      i;
+
+	if (end < begin)
+		return 0;
+	for (i = find_page(img, begin); i < img->page_count; i++) {
+		page = img->pages[i];
+		if (page->addr > end)
+			break;
+		first = begin > page->addr ? begin - page->addr : 0;
+		last  = end - page->addr < PAGE_MASK ? end - page->addr : PAGE_MASK;
+		for (bit = first; bit <= last;) {
+			// whole chunks are answered by their counter
+			if (bit % IMAGE_CHUNK_SIZE == 0 && bit + IMAGE_CHUNK_SIZE - 1 <= last) {
+				if (page->used[bit / IMAGE_CHUNK_SIZE])
+					return 1;
+				bit += IMAGE_CHUNK_SIZE;
+				continue;
+			}
+			if (page->mask[bit >> 5] & (1u << (bit & 31)))
+				return 1;
+			bit++;
+		}
+	}
+	return 0;
+}
+
+/* moves everything present in src into dst, overwriting bytes dst */
+/* already holds. src is left empty. Returns 0 if out of memory. */
+int image_merge(struct image* dst, struct image* src)
+{
+	struct image_page* page;
+	uint32_t           bit, run;
+	int                i, j, r = 1;
+
+	for (j = 0; j < src->page_count && r; j++) {
+		page = src->pages[j];
+		i    = locate_page(dst, page->addr);
+		if (i >= dst->page_count || dst->pages[i]->addr != page->addr) {
+			// dst has nothing here yet, the page can simply change owner
+			if (insert_page(dst, i, page))
+				src->pages[j] = NULL;
+			else
+				r = 0;
+			continue;
+		}
+		dst->last = i;
+		for (bit = 0; bit < IMAGE_PAGE_SIZE && r; bit += run) {
+			for (run = 0; bit + run < IMAGE_PAGE_SIZE && (page->mask[(bit + run) >> 5] & (1u << ((bit + run) & 31))); run++)
+				;
+			if (run == 0) {
+				run = 1;
+				continue;
+			}
+			r = image_write(dst, page->addr + bit, page->data + bit, (int)run);
+		}
+	}
+	image_clear(src);
+	return r;
+}
+
+void image_get_data(const struct image* img, uint32_t addr, int len, unsigned char* bytes)
+{
+	const struct image_page* page;
+	uint32_t                 off;
+	int                      i, n;
+
+	memset(bytes, 0xFF, len);
+	for (i = find_page(img, addr); i < img->page_count && len > 0; i++) {
+		page = img->pages[i];
+		if (page->addr > addr) {
+			n = page->addr - addr < (uint32_t)len ? (int)(page->addr - addr) : len;
+			addr += n;
+			bytes += n;
+			len -= n;
+			if (len == 0)
+				break;
+		}
+		// bytes that were never written are still 0xFF in the page
+		off = addr & PAGE_MASK;
+		n   = IMAGE_PAGE_SIZE - (int)off;
+		if (n > len)
+			n = len;
+		memcpy(bytes, page->data + off, n);
+		addr += n;
+		bytes += n;
+		len -= n;
+	}
+}
+
+/* returns 1 if every byte from addr to addr + len - 1 is 0xFF or not present */
+int image_is_blank(const struct image* img, uint32_t addr, int len)
+{
+	const struct image_page* page;
+	uint32_t                 off, last, end;
+	int                      i;
+
+	if (len <= 0)
+		return 1;
+	end = addr + (uint32_t)(len - 1);
+	if (end < addr)
+		end = 0xFFFFFFFF;
+	for (i = find_page(img, addr); i < img->page_count; i++) {
+		page = img->pages[i];
+		if (page->addr > end)
+			break;
+		off  = addr > page->addr ? addr - page->addr : 0;
+		last = end - page->addr < PAGE_MASK ? end - page->addr : PAGE_MASK;
+		while (off <= last) {
+			if (off % IMAGE_CHUNK_SIZE == 0 && off + IMAGE_CHUNK_SIZE - 1 <= last) {
+				if (page->nonblank[off / IMAGE_CHUNK_SIZE])
+					return 0;
+				off += IMAGE_CHUNK_SIZE;
+				continue;
+			}
+			// bytes that were never written are 0xFF
+			if (page->data[off] != 0xFF)
+				return 0;
+			off++;
+		}
+	}
+	return 1;
+}
+
+/* finds the first block aligned address at or after addr whose block */
+/* holds anything other than 0xFF. Returns 0 if there is none. */
+int image_next_block(const struct image* img, uint32_t addr, uint32_t block_size, uint32_t* next)
+{
+	const struct image_page* page;
+	int                      i;
+
+	if (block_size == 0)
+		return 0;
+	addr -= addr % block_size;
+	for (i = find_page(img, addr); i < img->page_count;) {
+		page = img->pages[i];
+		if (addr >= page->addr && addr - page->addr > PAGE_MASK) {
+			i++; // page is entirely below the block
+			continue;
+		}
+		if (page->addr > addr && page->addr - addr >= block_size) {
+			// skip the gap up to the block holding the next page
+			addr = page->addr - page->addr % block_size;
+		}
+		if (!image_is_blank(img, addr, (int)block_size)) {
+			*next = addr;
+			return 1;
+		}
+		if (addr + block_size < addr)
+			return 0;
+		addr += block_size;
+	}
+	return 0;
+}
+
+// appends the range from begin to end, joining it with the last one
+// if they touch. Returns 0 if out of memory
+static int add_range(struct image_ranges* ranges, uint32_t begin, uint32_t end)
+{
+	struct image_range* list;
+	int                 n;
+
+	if (ranges->count > 0 && ranges->list[ranges->count - 1].end + 1 == begin) {
+		ranges->list[ranges->count - 1].end = end;
+		return 1;
+	}
+	if (ranges->count == ranges->alloc) {
+		n    = ranges->alloc ? ranges->alloc * 2 : 16;
+		list = realloc(ranges->list, n * sizeof(*list));
+		if (list == NULL)
+			return 0;
+		ranges->list  = list;
+		ranges->alloc = n;
+	}
+	ranges->list[ranges->count].begin = begin;
+	ranges->list[ranges->count].end   = end;
+	ranges->count++;
+	return 1;
+}
+
+/* lists the ranges img holds bytes in. The masks are read a word at a */
+/* time, so full and empty stretches cost one test per 32 bytes. */
+/* Returns 0 if out of memory. */
+int image_get_ranges(const struct image* img, struct image_ranges* ranges)
+{
+	const struct image_page* page;
+	uint32_t                 word, bit, begin = 0;
+	int                      i, w, in = 0;
+
+	ranges->count = 0;
+	for (i = 0; i < img->page_count; i++) {
+		page = img->pages[i];
+		for (w = 0; w < IMAGE_PAGE_SIZE / 32; w++) {
+			word = page->mask[w];
+			if (word == (in ? 0xFFFFFFFF : 0))
+				continue;
+			for (bit = 0; bit < 32; bit++) {
+				if (!(word & (1u << bit)) == !in)
+					continue;
+				if (in && !add_range(ranges, begin, page->addr + w * 32 + bit - 1))
+					return 0;
+				begin = page->addr + w * 32 + bit;
+				in    = !in;
+			}
+		}
+		// a range only carries on into the next page if it follows on
+		if (in && (i + 1 == img->page_count || img->pages[i + 1]->addr != page->addr + IMAGE_PAGE_SIZE)) {
+			if (!add_range(ranges, begin, page->addr + PAGE_MASK))
+				return 0;
+			in = 0;
+		}
+	}
+	return 1;
+}
+
+/* finds the first byte both lists hold, walking them side by side. */
+/* Returns 1 and stores it in *addr if there is one, else 0. */
+int image_ranges_overlap(const struct image_ranges* a, const struct image_ranges* b, uint32_t* addr)
+{
+	int i = 0, j = 0;
+
+	while (i < a->count && j < b->count) {
+		if (a->list[i].end < b->list[j].begin) {
+			i++;
+		} else if (b->list[j].end < a->list[i].begin) {
+			j++;
+		} else {
+			*addr = a->list[i].begin > b->list[j].begin ? a->list[i].begin : b->list[j].begin;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void image_ranges_clear(struct image_ranges* ranges)
+{
+	free(ranges->list);
+	memset(ranges, 0, sizeof(*ranges));
+}
@@ -0,0 +1,71 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <stdint.h>
+
+// Sparse firmware image, only the pages that hold data are allocated.
+// Bytes that were never written read back as 0xFF (erased flash).
+#define IMAGE_PAGE_SIZE 1024
+
+// Each page keeps occupancy counters per chunk, so block sized queries
+// don't have to look at the data. This is the smallest HalfKay block.
+#define IMAGE_CHUNK_SIZE 128
+#define IMAGE_CHUNKS     (IMAGE_PAGE_SIZE / IMAGE_CHUNK_SIZE)
+
+struct image_page {
+	uint32_t       addr;                   // page aligned start address
+	unsigned short used[IMAGE_CHUNKS];     // bytes present, per chunk
+	unsigned short nonblank[IMAGE_CHUNKS]; // bytes other than 0xFF, per chunk
+	uint32_t       mask[IMAGE_PAGE_SIZE / 32];
+	unsigned char  data[IMAGE_PAGE_SIZE];
+};
+
+// An all zero struct image is a valid, empty image.
+struct image {
+	struct image_page** pages; // sorted by address
+	int                 page_count;
+	int                 page_alloc;
+	int                 last; // page of the last write, speeds up sequential writes
+};
+
+// The address ranges an image holds bytes in, sorted and with adjacent
+// ranges joined. end is the last byte of a range, so a range may reach
+// the top of the address space. An all zero struct image_ranges is a
+// valid, empty list.
+struct image_range {
+	uint32_t begin;
+	uint32_t end;
+};
+
+struct image_ranges {
+	struct image_range* list;
+	int                 count;
+	int                 alloc;
+};
+
+// Firmware Image Functions
+void image_clear(struct image* img);
+int  image_write(struct image* img, uint32_t addr, const unsigned char* data, int len);
+int  image_merge(struct image* dst, struct image* src);
+int  image_bytes_within_range(const struct image* img, uint32_t begin, uint32_t end);
+void image_get_data(const struct image* img, uint32_t addr, int len, unsigned char* bytes);
+int  image_is_blank(const struct image* img, uint32_t addr, int len);
+int  image_next_block(const struct image* img, uint32_t addr, uint32_t block_size, uint32_t* next);
+int  image_get_ranges(const struct image* img, struct image_ranges* ranges);
+int  image_ranges_overlap(const struct image_ranges* a, const struct image_ranges* b, uint32_t* addr);
+void image_ranges_clear(struct image_ranges* ranges);
@@ -30,20 +30,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "daemon.h"
 #include "dev.h"
+#if defined(USE_REPLAY)
+#include "dev-replay.h"
+#endif
+#include "hotplug.h"
 #include "ihex.h"
+#include "manifest.h"
 #include "misc.h"
-//#include "param.h"
-
-// options (from user via command line args)
-int         wait_for_device_to_appear = 0;
-int         hard_reboot_device        = 0;
-int         soft_reboot_device        = 0;
-int         reboot_after_programming  = 1;
-int         verbose                   = 0;
-int         boot_only                 = 0;
-int         code_size = 0, block_size = 0;
-const char* filename = NULL;
+#include "param.h"
+#include "program.h"
+#include "record.h"
+#include "stats.h"
+#include "thread.h"
+#include "trace.h"
 
 /****************************************************************/
 /*                                                              */
@@ -51,15 +52,234 @@ const char* filename = NULL;
 /*                                                              */
 /****************************************************************/
 
+static int            hex_bytes;
+static struct thread* hex_reader = NULL;
+
+static void read_hex_thread(void* arg)
+{
+	double begin = stats_begin();
+
+	(void)arg;
+	trace_thread_name("hex reader");
+	hex_bytes = read_intel_hex_files(input_files, input_count);
+	stats_end(STATS_PARSE, begin);
+}
+
+// reports how reading the input files went, exits if they could not
+// be read
+static void report_hex_read(int bytes)
+{
+	if (bytes < 0 && input_count > 1)
+		die("error reading or merging the %d input files\n", input_count);
+	if (bytes < 0)
+		die("error reading intel hex file \"%s\"\n", filename);
+	if (input_count > 1)
+		printf_verbose("Read %d files: %d bytes, %.1f%% usage\n", input_count, bytes, (double)bytes / (double)code_size * 100.0);
+	else
+		printf_verbose("Read \"%s\": %d bytes, %.1f%% usage\n", filename, bytes, (double)bytes / (double)code_size * 100.0);
+}
+
+// waits for the background read of the hex file to complete and
+// reports the result, exits if the file could not be read
+static void finish_hex_read(void)
+{
+	if (!hex_reader)
+		return;
+	thread_join(hex_reader);
+	hex_reader = NULL;
+	report_hex_read(hex_bytes);
+}
+
+/****************************************************************/
+/*                                                              */
+/*                      Multiple Devices                        */
+/*                                                              */
+/****************************************************************/
+
+#define MAX_DEVICES 64
+
+struct device_job {
+	struct teensy_info    info;
+	struct teensy_device* dev; // NULL if it couldn't be opened or reopened
+	struct thread*        thread;
+	int                   opened;
+	int                   blocks;
+	int                   ok;
+	enum teensy_error     error; // why writing failed
+	double                seconds;
+};
+
+static struct device_job jobs[MAX_DEVICES];
+static int               job_count = 0;
+
+// true if path is one of the comma separated --devices paths, or if
+// every device was asked for
+static int device_selected(const char* path)
+{
+	const char* p = device_paths;
+	const char* end;
+	size_t      len = strlen(path);
+
+	if (!p)
+		return 1;
+	while (*p) {
+		end = strchr(p, ',');
+		if (!end)
+			end = p + strlen(p);
+		if ((size_t)(end - p) == len && strncmp(p, path, len) == 0)
+			return 1;
+		p = *end ? end + 1 : end;
+	}
+	return 0;
+}
+
+// number of devices that have to be found before programming starts
+static int devices_wanted(void)
+{
+	const char* p;
+	int         count = 1;
+
+	if (!device_paths)
+		return 1;
+	for (p = device_paths; *p; p++) {
+		if (*p == ',')
+			count++;
+	}
+	return count;
+}
+
+// fills jobs[] with the selected devices which are attached right now
+static int find_device_jobs(void)
+{
+	struct teensy_info list[MAX_DEVICES];
+	double             begin = stats_begin();
+	int                i, n;
+
+	n = teensy_list(list, MAX_DEVICES);
+	stats_end(STATS_ENUMERATE, begin);
+	job_count = 0;
+	for (i = 0; i < n; i++) {
+		if (!device_selected(list[i].path))
+			continue;
+		memset(&jobs[job_count], 0, sizeof(jobs[0]));
+		jobs[job_count++].info = list[i];
+	}
+	return job_count;
+}
+
+static void device_job_thread(void* arg)
+{
+	struct device_job* job   = (struct device_job*)arg;
+	double             begin = monotonic_time();
+
+	trace_thread_name(job->info.path);
+	job->ok = 1;
+	if (!boot_only) {
+		job->blocks = program_device(&job->dev, &job->info, 0);
+		job->ok     = job->blocks >= 0;
+		job->error  = teensy_write_error();
+	}
+	if (job->ok && (boot_only || reboot_after_programming))
+		job->ok = boot(job->dev);
+	job->seconds = monotonic_time() - begin;
+}
+
+// programs every device in jobs[] at the same time, one thread per
+// device, all sharing the image. Returns the number of failed devices
+static int program_devices(void)
+{
+	int i, failed = 0;
+
+	for (i = 0; i < job_count; i++) {
+		jobs[i].dev    = teensy_open_device(&jobs[i].info);
+		jobs[i].opened = jobs[i].dev != NULL;
+		if (jobs[i].dev) {
+			record_device(jobs[i].dev, &jobs[i].info);
+			jobs[i].thread = thread_start(device_job_thread, &jobs[i]);
+		}
+	}
+	for (i = 0; i < job_count; i++) {
+		if (!jobs[i].opened) {
+			printf("%s: unable to open device\n", jobs[i].info.path);
+			failed++;
+			continue;
+		}
+		thread_join(jobs[i].thread);
+		if (jobs[i].dev)
+			teensy_close_device(jobs[i].dev);
+		if (!jobs[i].ok) {
+			printf("%s: error writing to Teensy (%s)\n", jobs[i].info.path, teensy_error_name(jobs[i].error));
+			failed++;
+		} else if (boot_only) {
+			printf("%s: booted\n", jobs[i].info.path);
+		} else {
+			printf("%s: programmed %d blocks in %.2f seconds\n", jobs[i].info.path, jobs[i].blocks, jobs[i].seconds);
+		}
+	}
+	return failed;
+}
+
+/****************************************************************/
+/*                                                              */
+/*                       Main Program                           */
+/*                                                              */
+/****************************************************************/
+
+// runs when the program exits, also after errors
+static void write_stats(void)
+{
+	if (!stats_write(stats_file))
+		fprintf(stderr, "Unable to write stats to \"%s\"\n", stats_file);
+}
+
 int main(int argc, char** argv)
 {
-	unsigned char buf[2048];
-	int           num, addr, r, write_size;
+	struct teensy_info    list[MAX_DEVICES];
+	struct program_target target;
+	struct teensy_device* dev;
+	double                begin;
+	int                   i, r, num, multiple, stdin_hex, streaming;
 
-	int block_count = 0, waited = 0;
+	int waited = 0, hotplug;
 
 	// parse command line arguments
+	stats_start();
 	parse_options(argc, argv);
+	if (stats_file)
+		atexit(write_stats);
+	if (trace_file_name) {
+		if (!trace_open(trace_file_name))
+			die("Unable to write trace to \"%s\"\n", trace_file_name);
+		atexit(trace_close);
+	}
+	if (record_file_name) {
+		if (!record_open(record_file_name))
+			die("Unable to write recording to \"%s\"\n", record_file_name);
+		atexit(record_close);
+	}
+#if defined(USE_REPLAY)
+	if (!replay_file_name)
+		usage("--replay=<file> must be given to this build");
+	if (!replay_open(replay_file_name))
+		die("Unable to read recording \"%s\"\n", replay_file_name);
+#endif
+	teensy_select(port_selector, serial_selector);
+	if (list_devices) {
+		num = teensy_list(list, MAX_DEVICES);
+		for (i = 0; i < num; i++) {
+			if (list[i].serial[0])
+				printf("%s %s\n", list[i].path, list[i].serial);
+			else
+				printf("%s\n", list[i].path);
+		}
+		return 0;
+	}
+	if (daemon_socket)
+		return daemon_serve(daemon_socket);
+	if (connect_socket)
+		return daemon_submit(connect_socket);
+	if (manifest_file)
+		return run_manifest(manifest_file, results_file) ? 1 : 0;
 	if (!filename && !boot_only) {
 		usage("Filename must be specified");
 	}
@@ -67,109 +287,107 @@ int main(int argc, char** argv)
 		usage("MCU type must be specified");
 	}
 	printf_verbose("Teensy Loader, Command Line, Version 2.3\n");
-
-	if (block_size == 512 || block_size == 1024) {
-		write_size = block_size + 64;
-	} else {
-		write_size = block_size + 2;
-	};
+	multiple = all_devices || device_paths;
 
 	if (!boot_only) {
-		// read the intel hex file
-		// this is done first so any error is reported before using USB
-		num = read_intel_hex(filename);
-		if (num < 0)
-			die("error reading intel hex file \"%s\"", filename);
-		printf_verbose("Read \"%s\": %d bytes, %.1f%% usage\n", filename, num, (double)num / (double)code_size * 100.0);
+		// read the intel hex file in the background, while the device
+		// is found, rebooted or waited for. Errors are still reported
+		// before anything is written to the device.
+		hex_reader = thread_start(read_hex_thread, NULL);
 	}
 
-	// open the USB device
+	// open the USB device. Listen for arrivals first, so a device
+	// that appears right after a failed open isn't missed
+	hotplug = hotplug_open();
 	while (1) {
-		if (teensy_open())
+		if (multiple) {
+			if (find_device_jobs() >= devices_wanted())
+				break;
+		} else if (teensy_open()) {
 			break;
+		}
+		if (thread_finished(hex_reader))
+			finish_hex_read();
 		if (hard_reboot_device) {
-			if (!hard_reboot())
+			begin = stats_begin();
+			r     = hard_reboot();
+			stats_end(STATS_REBOOT, begin);
+			if (!r)
 				die("Unable to find rebootor\n");
 			printf_verbose("Hard Reboot performed\n");
 			hard_reboot_device        = 0; // only hard reboot once
 			wait_for_device_to_appear = 1;
 		}
 		if (soft_reboot_device) {
-			if (soft_reboot()) {
+			begin = stats_begin();
+			r     = soft_reboot();
+			stats_end(STATS_REBOOT, begin);
+			if (r) {
 				printf_verbose("Soft reboot performed\n");
 			}
 			soft_reboot_device        = 0;
 			wait_for_device_to_appear = 1;
 		}
-		if (!wait_for_device_to_appear)
+		if (!wait_for_device_to_appear) {
+			finish_hex_read();
 			die("Unable to open device (hint: try -w option)\n");
+		}
 		if (!waited) {
 			printf_verbose("Waiting for Teensy device...\n");
 			printf_verbose(" (hint: press the reset button)\n");
 			waited = 1;
 		}
-		delay(0.25);
+		// with hotplug events the device is opened as soon as it
+		// enumerates, polling only remains as a fallback
+		hotplug_wait(hotplug ? 2.0 : 0.25);
 	}
+	hotplug_close();
 	printf_verbose("Found HalfKay Bootloader\n");
 
+	// hex from standard input is written to a single device while it
+	// is still being read, as far as it is complete
+	stdin_hex = 0;
+	for (i = 0; i < input_count; i++) {
+		if (strcmp(input_files[i], "-") == 0)
+			stdin_hex = !boot_only;
+	}
+	streaming = stdin_hex && !multiple && input_count == 1;
+	if (!streaming)
+		finish_hex_read();
+
+	// if we waited for the device, read the hex file again if it
+	// changed while we were waiting
+	if (!boot_only && !stdin_hex && waited && ihex_files_changed(input_files, input_count)) {
+		begin = stats_begin();
+		num   = read_intel_hex_files(input_files, input_count);
+		stats_end(STATS_PARSE, begin);
+		report_hex_read(num);
+	}
+
+	if (multiple)
+		return program_devices() ? 1 : 0;
+
 	if (boot_only) {
-		boot(buf, write_size);
+		boot(teensy_device());
 		teensy_close();
 		return 0;
 	}
 
-	// if we waited for the device, read the hex file again
-	// perhaps it changed while we were waiting?
-	if (waited) {
-		num = read_intel_hex(filename);
-		if (num < 0)
-			die("error reading intel hex file \"%s\"", filename);
-		printf_verbose("Read \"%s\": %d bytes, %.1f%% usage\n", filename, num, (double)num / (double)code_size * 100.0);
-	}
-
 	// program the data
 	printf_verbose("Programming");
 	fflush(stdout);
-	for (addr = 0; addr < code_size; addr += block_size) {
-		if (block_count > 0) {
-			// don't waste time on blocks that are unused,
-			// but always do the first one to erase the chip
-			if (!ihex_bytes_within_range(addr, addr + block_size - 1))
-				continue;
-			if (memory_is_blank(addr, block_size))
-				continue;
-		}
-		printf_verbose(".");
-		if (block_size <= 256 && code_size < 0x10000) {
-			buf[0] = addr & 255;
-			buf[1] = (addr >> 8) & 255;
-			ihex_get_data(addr, block_size, buf + 2);
-			write_size = block_size + 2;
-		} else if (block_size == 256) {
-			buf[0] = (addr >> 8) & 255;
-			buf[1] = (addr >> 16) & 255;
-			ihex_get_data(addr, block_size, buf + 2);
-			write_size = block_size + 2;
-		} else if (block_size == 512 || block_size == 1024) {
-			buf[0] = addr & 255;
-			buf[1] = (addr >> 8) & 255;
-			buf[2] = (addr >> 16) & 255;
-			memset(buf + 3, 0, 61);
-			ihex_get_data(addr, block_size, buf + 64);
-			write_size = block_size + 64;
-		} else {
-			die("Unknown code/block size\n");
-		}
-		r = teensy_write(buf, write_size, block_count <= 4 ? 45.0 : 0.5);
-		if (!r)
-			die("error writing to Teensy\n");
-		block_count = block_count + 1;
-	}
-	printf_verbose("\n");
+	target.img        = ihex_image();
+	target.code_size  = code_size;
+	target.block_size = block_size;
+	target.stream     = streaming;
+	dev               = teensy_device();
+	if (program_resume(&dev, teensy_device_info(), &target, 1) < 0)
+		die("error writing to Teensy (%s)\n", teensy_error_name(teensy_write_error()));
+	finish_hex_read();
 
 	// reboot to the user's new code
 	if (reboot_after_programming) {
-		boot(buf, write_size);
+		boot(teensy_device());
 	}
 	teensy_close();
 	return 0;
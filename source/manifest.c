@@ -0,0 +1,381 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "manifest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dev.h"
+#include "hotplug.h"
+#include "ihex.h"
+#include "image.h"
+#include "mapfile.h"
+#include "misc.h"
+#include "param.h"
+#include "program.h"
+#include "record.h"
+#include "stats.h"
+#include "thread.h"
+#include "trace.h"
+
+/****************************************************************/
+/*                                                              */
+/*                    Manifest - Batch Jobs                     */
+/*                                                              */
+/****************************************************************/
+
+#define MAX_JOBS 64
+
+// a hex file parsed for one MCU, shared by every job using both
+struct manifest_image {
+	const char*  file;
+	int          code_size;
+	int          block_size;
+	int          bytes; // -1 if the file couldn't be read
+	struct image img;
+};
+
+struct manifest_job {
+	int                    line;
+	const char*            selector;
+	const char*            port;
+	const char*            serial;
+	const char*            mcu;
+	const char*            file;
+	int                    code_size;
+	int                    block_size;
+	struct manifest_image* image;
+	struct teensy_info     info;
+	int                    found;
+	struct teensy_device*  dev; // NULL if it couldn't be opened or reopened
+	struct thread*         thread;
+	int                    opened;
+	const char*            error; // NULL if the job succeeded
+	char                   message[64];
+	int                    blocks;
+	double                 seconds;
+};
+
+static struct manifest_image images[MAX_JOBS];
+static struct manifest_job   jobs[MAX_JOBS];
+static int                   image_count = 0;
+static int                   job_count   = 0;
+
+// splits off the next space separated word, NULL at the end of line
+static char* next_word(char** p)
+{
+	char* word;
+
+	*p += strspn(*p, " \t");
+	if (!**p)
+		return NULL;
+	word = *p;
+	*p += strcspn(*p, " \t");
+	if (**p)
+		*(*p)++ = '\0';
+	return word;
+}
+
+// "port=<path>", "serial=<sn>", both separated by a comma, or "*"
+static int parse_selector(char* selector, struct manifest_job* job)
+{
+	char* part;
+	char* next;
+
+	if (strcmp(selector, "*") == 0)
+		return 1;
+	for (part = selector; part; part = next) {
+		next = strchr(part, ',');
+		if (next)
+			*next++ = '\0';
+		if (strncmp(part, "port=", 5) == 0 && part[5])
+			job->port = part + 5;
+		else if (strncmp(part, "serial=", 7) == 0 && part[7])
+			job->serial = part + 7;
+		else
+			return 0;
+	}
+	return 1;
+}
+
+static void read_manifest(const char* manifest)
+{
+	struct mapped_file   file;
+	struct manifest_job* job;
+	char*                text;
+	char*                line;
+	char*                end;
+	char*                selector;
+	int                  lineno = 0;
+
+	if (!map_file(manifest, &file))
+		die("Unable to read manifest \"%s\"\n", manifest);
+	// the jobs point into this copy until the program exits
+	text = malloc(file.size + 1);
+	if (!text)
+		die("Out of memory\n");
+	memcpy(text, file.data, file.size);
+	text[file.size] = '\0';
+	unmap_file(&file);
+
+	for (line = text; line; line = end) {
+		end = strchr(line, '\n');
+		if (end)
+			*end++ = '\0';
+		lineno++;
+		line[strcspn(line, "\r")] = '\0';
+		selector                  = next_word(&line);
+		if (!selector || selector[0] == '#')
+			continue;
+		if (job_count >= MAX_JOBS)
+			die("%s:%d: too many jobs, at most %d are supported\n", manifest, lineno, MAX_JOBS);
+		job           = &jobs[job_count++];
+		job->line     = lineno;
+		job->selector = strdup(selector);
+		job->mcu      = next_word(&line);
+		line += strspn(line, " \t"); // the file name may contain spaces
+		job->file = line;
+		if (!job->selector || !parse_selector(selector, job) || !job->mcu || (!*line && !boot_only))
+			die("%s:%d: expected \"<selector> <mcu> <file.hex>\"\n", manifest, lineno);
+		if (!find_mcu(job->mcu, &job->code_size, &job->block_size))
+			die("%s:%d: unknown MCU type \"%s\"\n", manifest, lineno, job->mcu);
+	}
+}
+
+// parses every file once per MCU it is used with
+static void read_images(void)
+{
+	struct manifest_job*   job;
+	struct manifest_image* image;
+	double                 begin;
+	int                    i, j;
+
+	for (i = 0; i < job_count && !boot_only; i++) {
+		job   = &jobs[i];
+		image = NULL;
+		for (j = 0; j < image_count; j++) {
+			image = &images[j];
+			if (strcmp(image->file, job->file) == 0 && image->code_size == job->code_size && image->block_size == job->block_size)
+				break;
+		}
+		if (j == image_count) {
+			image             = &images[image_count++];
+			image->file       = job->file;
+			image->code_size  = job->code_size;
+			image->block_size = job->block_size;
+			code_size         = job->code_size; // the parser checks addresses against these
+			block_size        = job->block_size;
+			begin             = stats_begin();
+			image->bytes      = read_intel_hex(job->file);
+			stats_end(STATS_PARSE, begin);
+			if (image->bytes >= 0) {
+				printf_verbose("Read \"%s\": %d bytes, %.1f%% usage\n", image->file, image->bytes, (double)image->bytes / (double)image->code_size * 100.0);
+				ihex_swap_image(&image->img);
+			}
+		}
+		job->image = image;
+		if (!image || image->bytes < 0)
+			job->error = "error reading intel hex file";
+	}
+}
+
+// true if another job already claimed the device at path
+static int device_claimed(const char* path)
+{
+	int i;
+
+	for (i = 0; i < job_count; i++) {
+		if (jobs[i].found && strcmp(jobs[i].info.path, path) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+// assigns attached devices to the jobs still without one. Jobs which
+// name a port or serial number go first, so "*" only takes the rest.
+// Returns the number of jobs still waiting for a device.
+static int find_devices(void)
+{
+	struct teensy_info   list[MAX_JOBS];
+	struct manifest_job* job;
+	double               begin;
+	int                  pass, i, j, n, missing = 0;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < job_count; i++) {
+			job = &jobs[i];
+			if (job->found || job->error || (pass == 0) != (job->port || job->serial))
+				continue;
+			teensy_select(job->port, job->serial);
+			begin = stats_begin();
+			n     = teensy_list(list, MAX_JOBS);
+			stats_end(STATS_ENUMERATE, begin);
+			for (j = 0; j < n && !job->found; j++) {
+				if (device_claimed(list[j].path))
+					continue;
+				job->info  = list[j];
+				job->found = 1;
+			}
+			if (!job->found)
+				missing++;
+		}
+	}
+	teensy_select(NULL, NULL);
+	return missing;
+}
+
+// soft reboots the board of every job still without a device
+static void soft_reboot_jobs(void)
+{
+	double begin;
+	int    i, r;
+
+	for (i = 0; i < job_count; i++) {
+		if (jobs[i].found || jobs[i].error)
+			continue;
+		teensy_select(jobs[i].port, jobs[i].serial);
+		begin = stats_begin();
+		r     = soft_reboot();
+		stats_end(STATS_REBOOT, begin);
+		if (r)
+			printf_verbose("Soft reboot performed (line %d)\n", jobs[i].line);
+	}
+	teensy_select(NULL, NULL);
+}
+
+static void job_thread(void* arg)
+{
+	struct manifest_job*  job   = (struct manifest_job*)arg;
+	struct program_target target;
+	double                begin = monotonic_time();
+
+	trace_thread_name(job->info.path);
+	if (!boot_only) {
+		target.img        = &job->image->img;
+		target.code_size  = job->code_size;
+		target.block_size = job->block_size;
+		target.stream     = 0;
+		job->blocks       = program_resume(&job->dev, &job->info, &target, 0);
+		if (job->blocks < 0) {
+			snprintf(job->message, sizeof(job->message), "error writing to Teensy (%s)", teensy_error_name(teensy_write_error()));
+			job->error = job->message;
+		}
+	}
+	if (!job->error && (boot_only || reboot_after_programming) && !boot_block_size(job->dev, job->block_size))
+		job->error = "error booting Teensy";
+	job->seconds = monotonic_time() - begin;
+}
+
+static void write_results(const char* results, double seconds, int failed)
+{
+	struct manifest_job* job;
+	FILE*                out = stdout;
+	int                  i;
+
+	if (strcmp(results, "-") != 0) {
+		out = fopen(results, "w");
+		if (!out)
+			die("Unable to write results to \"%s\"\n", results);
+	}
+	fprintf(out, "{\n\t\"jobs\": [\n");
+	for (i = 0; i < job_count; i++) {
+		job = &jobs[i];
+		fprintf(out, "\t\t{\"line\": %d, \"selector\": ", job->line);
+		json_print(out, job->selector);
+		fprintf(out, ", \"mcu\": ");
+		json_print(out, job->mcu);
+		fprintf(out, ", \"file\": ");
+		json_print(out, boot_only ? NULL : job->file);
+		fprintf(out, ", \"device\": ");
+		json_print(out, job->found ? job->info.path : NULL);
+		fprintf(out, ", \"status\": \"%s\", \"error\": ", job->error ? "failed" : "ok");
+		json_print(out, job->error);
+		fprintf(out, ", \"blocks\": %d, \"seconds\": %.3f}%s\n", job->blocks > 0 ? job->blocks : 0, job->seconds, i + 1 < job_count ? "," : "");
+	}
+	fprintf(out, "\t],\n\t\"ok\": %d,\n\t\"failed\": %d,\n\t\"seconds\": %.3f\n}\n", job_count - failed, failed, seconds);
+	if (out != stdout)
+		fclose(out);
+}
+
+int run_manifest(const char* manifest, const char* results)
+{
+	double start = monotonic_time();
+	double begin;
+	int    i, r, hotplug, waited = 0, failed = 0;
+
+	read_manifest(manifest);
+	if (!job_count)
+		die("No jobs in manifest \"%s\"\n", manifest);
+	read_images();
+
+	// find a device for every job, waiting for them if asked to
+	hotplug = hotplug_open();
+	while (find_devices() > 0) {
+		if (hard_reboot_device) {
+			begin = stats_begin();
+			r     = hard_reboot();
+			stats_end(STATS_REBOOT, begin);
+			if (!r)
+				die("Unable to find rebootor\n");
+			printf_verbose("Hard Reboot performed\n");
+			hard_reboot_device        = 0;
+			wait_for_device_to_appear = 1;
+		}
+		if (soft_reboot_device) {
+			soft_reboot_jobs();
+			soft_reboot_device        = 0;
+			wait_for_device_to_appear = 1;
+		}
+		if (!wait_for_device_to_appear)
+			break;
+		if (!waited) {
+			printf_verbose("Waiting for Teensy devices...\n");
+			waited = 1;
+		}
+		hotplug_wait(hotplug ? 2.0 : 0.25);
+	}
+	hotplug_close();
+
+	// then run every job on its own thread
+	for (i = 0; i < job_count; i++) {
+		if (jobs[i].error)
+			continue;
+		if (!jobs[i].found) {
+			jobs[i].error = "unable to find device";
+			continue;
+		}
+		jobs[i].dev = teensy_open_device(&jobs[i].info);
+		if (!jobs[i].dev) {
+			jobs[i].error = "unable to open device";
+			continue;
+		}
+		record_device(jobs[i].dev, &jobs[i].info);
+		jobs[i].opened = 1;
+		jobs[i].thread = thread_start(job_thread, &jobs[i]);
+	}
+	for (i = 0; i < job_count; i++) {
+		if (jobs[i].opened)
+			thread_join(jobs[i].thread);
+		if (jobs[i].dev)
+			teensy_close_device(jobs[i].dev);
+		if (jobs[i].error)
+			failed++;
+	}
+	write_results(results, monotonic_time() - start, failed);
+	return failed;
+}
@@ -0,0 +1,26 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+// Manifest Functions
+// A manifest lists one job per line, "<selector> <mcu> <file.hex>".
+// The selector is "port=<path>", "serial=<sn>", both separated by a
+// comma, or "*" for any device. Empty lines and lines starting with #
+// are skipped. Every file is parsed once, all jobs run at the same
+// time, and a JSON summary is written to results ("-" is stdout).
+// Returns the number of jobs that failed.
+int run_manifest(const char* manifest, const char* results);
@@ -0,0 +1,206 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "mapfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/****************************************************************/
+/*                                                              */
+/*                     Memory Mapped Files                      */
+/*                                                              */
+/****************************************************************/
+
+// fallback for anything that can't be mapped, reads until end of file
+static int read_whole_file(FILE* fp, struct mapped_file* file)
+{
+	char*  buf = NULL;
+	char*  tmp;
+	size_t alloc = 0, size = 0, n;
+
+	while (1) {
+		if (size == alloc) {
+			alloc = alloc ? alloc * 2 : 65536;
+			tmp   = realloc(buf, alloc);
+			if (tmp == NULL) {
+				free(buf);
+				return 0;
+			}
+			buf = tmp;
+		}
+		n = fread(buf + size, 1, alloc - size, fp);
+		if (n == 0)
+			break;
+		size += n;
+	}
+	if (ferror(fp)) {
+		free(buf);
+		return 0;
+	}
+	file->data   = buf;
+	file->size   = size;
+	file->mapped = 0;
+	return 1;
+}
+
+#if defined(WIN32)
+
+int map_file(const char* filename, struct mapped_file* file)
+{
+	HANDLE        h, map;
+	LARGE_INTEGER size;
+	FILE*         fp;
+	void*         view;
+	int           r;
+
+	memset(file, 0, sizeof(*file));
+	h = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return 0;
+	if (GetFileType(h) == FILE_TYPE_DISK && GetFileSizeEx(h, &size) && size.QuadPart > 0 && (unsigned long long)size.QuadPart <= (size_t)-1) {
+		map = CreateFileMapping(h, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map != NULL) {
+			view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(map);
+			if (view != NULL) {
+				CloseHandle(h);
+				file->data   = view;
+				file->size   = (size_t)size.QuadPart;
+				file->mapped = 1;
+				return 1;
+			}
+		}
+	}
+	CloseHandle(h);
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return 0;
+	r = read_whole_file(fp, file);
+	fclose(fp);
+	return r;
+}
+
+void unmap_file(struct mapped_file* file)
+{
+	if (file->mapped)
+		UnmapViewOfFile(file->data);
+	else
+		free((void*)file->data);
+	memset(file, 0, sizeof(*file));
+}
+
+#else
+
+int map_file(const char* filename, struct mapped_file* file)
+{
+	struct stat st;
+	FILE*       fp;
+	void*       addr;
+	int         fd, r;
+
+	memset(file, 0, sizeof(*file));
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (unsigned long long)st.st_size <= (size_t)-1) {
+		addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED) {
+			// the parser reads the file front to back exactly once
+			madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+			close(fd);
+			file->data   = addr;
+			file->size   = (size_t)st.st_size;
+			file->mapped = 1;
+			return 1;
+		}
+	}
+
+	// pipes, fifos and empty files can't be mapped
+	fp = fdopen(fd, "rb");
+	if (fp == NULL) {
+		close(fd);
+		return 0;
+	}
+	r = read_whole_file(fp, file);
+	fclose(fp);
+	return r;
+}
+
+void unmap_file(struct mapped_file* file)
+{
+	if (file->mapped)
+		munmap((void*)file->data, file->size);
+	else
+		free((void*)file->data);
+	memset(file, 0, sizeof(*file));
+}
+
+#endif
+
+/* fills in size and modification time, returns 1 for regular files */
+/* and 0 for anything else (pipes, devices) or if it doesn't exist */
+int stat_file(const char* filename, struct file_stamp* stamp)
+{
+#if defined(WIN32)
+	struct _stat64 st;
+
+	memset(stamp, 0, sizeof(*stamp));
+	if (_stat64(filename, &st) != 0 || !(st.st_mode & _S_IFREG))
+		return 0;
+	stamp->mtime = (long long)st.st_mtime * 1000000000LL;
+#else
+	struct stat st;
+
+	memset(stamp, 0, sizeof(*stamp));
+	if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode))
+		return 0;
+#if defined(__APPLE__)
+	stamp->mtime = (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+	stamp->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+#endif
+	stamp->size = (unsigned long long)st.st_size;
+	return 1;
+}
+
+/* 64 bit FNV-1a */
+uint64_t hash_data(const void* data, size_t size)
+{
+	const unsigned char* p    = data;
+	uint64_t             hash = 0xCBF29CE484222325ull;
+	size_t               i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
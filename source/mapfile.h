@@ -0,0 +1,42 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Read-only view of a whole file. Regular files are memory mapped,
+// anything that can't be mapped (pipes, character devices) is read
+// into a heap buffer instead.
+struct mapped_file {
+	const char* data;
+	size_t      size;
+	int         mapped; // 1 if data is a mapping, 0 if it was read
+};
+
+// Size and modification time of a regular file, used together with a
+// hash of the contents to tell whether a file changed since it was read.
+struct file_stamp {
+	unsigned long long size;
+	long long          mtime;
+};
+
+// Mapped File Functions
+int      map_file(const char* filename, struct mapped_file* file);
+void     unmap_file(struct mapped_file* file);
+int      stat_file(const char* filename, struct file_stamp* stamp);
+uint64_t hash_data(const void* data, size_t size);
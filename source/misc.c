@@ -21,12 +21,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "dev.h"
+#include "ihex.h"
 #include "param.h"
 
 #ifndef _MSC_VER
 #include <unistd.h>
 #endif
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 /****************************************************************/
 /*                                                              */
@@ -57,6 +62,23 @@ void delay(double seconds)
 #endif
 }
 
+// seconds since an arbitrary point, never goes backwards
+double monotonic_time(void)
+{
+#if defined(WIN32)
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+#endif
+}
+
 void die(const char* str, ...)
 {
 	va_list ap;
@@ -80,7 +102,7 @@ static const struct {
 	{"atmega32u4", 32256, 128},
 	{"at90usb646", 64512, 256},
 	{"at90usb1286", 130048, 256},
-#if defined(USE_LIBUSB) || defined(USE_APPLE_IOKIT) || defined(USE_WIN32)
+#if defined(USE_LIBUSB) || defined(USE_LIBUSB1) || defined(USE_HIDRAW) || defined(USE_APPLE_IOKIT) || defined(USE_WIN32) || defined(USE_SIM) || defined(USE_REPLAY)
 	{"mkl26z64", 63488, 512},
 	{"mk20dx128", 131072, 1024},
 	{"mk20dx256", 262144, 1024},
@@ -114,22 +136,30 @@ void list_mcus()
 	exit(1);
 }
 
-void read_mcu(char* name)
+// looks up an MCU by name, returns 0 if it isn't known
+int find_mcu(const char* name, int* code_size, int* block_size)
 {
 	int i;
 
+	for (i = 0; MCUs[i].name != NULL; i++) {
+		if (strcasecmp(name, MCUs[i].name) == 0) {
+			*code_size  = MCUs[i].code_size;
+			*block_size = MCUs[i].block_size;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void read_mcu(char* name)
+{
 	if (name == NULL) {
 		fprintf(stderr, "No MCU specified.\n");
 		list_mcus();
 	}
 
-	for (i = 0; MCUs[i].name != NULL; i++) {
-		if (strcasecmp(name, MCUs[i].name) == 0) {
-			code_size  = MCUs[i].code_size;
-			block_size = MCUs[i].block_size;
-			return;
-		}
-	}
+	if (find_mcu(name, &code_size, &block_size))
+		return;
 
 	fprintf(stderr, "Unknown MCU type \"%s\"\n", name);
 	list_mcus();
@@ -165,6 +195,22 @@ void parse_flag(char* arg)
 	}
 }
 
+// long options which never take a value, so the next argument isn't
+// mistaken for one
+static int option_is_switch(const char* name)
+{
+	return strcasecmp(name, "help") == 0 || strcasecmp(name, "list-mcus") == 0 || strcasecmp(name, "list-devices") == 0 || strcasecmp(name, "all") == 0;
+}
+
+// every file name given is merged into one image, filename is the first
+static void add_input_file(char* arg)
+{
+	if (input_count == MAX_INPUT_FILES)
+		usage("Too many files");
+	input_files[input_count++] = arg;
+	filename                   = input_files[0];
+}
+
 void parse_options(int argc, char** argv)
 {
 	int   i;
@@ -184,7 +230,8 @@ void parse_options(int argc, char** argv)
 				char* val  = strchr(name, '=');
 				if (val == NULL) {
 					//value must be the next string.
-					val = argv[++i];
+					if (!option_is_switch(name))
+						val = argv[++i];
 				} else {
 					//we found an =, so split the string at it.
 					*val = '\0';
@@ -197,25 +244,66 @@ void parse_options(int argc, char** argv)
 					read_mcu(val);
 				else if (strcasecmp(name, "list-mcus") == 0)
 					list_mcus();
+				else if (strcasecmp(name, "threads") == 0 && val)
+					parse_threads = atoi(val);
+				else if (strcasecmp(name, "base-address") == 0 && val)
+					base_address = (unsigned)strtoul(val, NULL, 0);
+				else if (strcasecmp(name, "list-devices") == 0)
+					list_devices = 1;
+				else if (strcasecmp(name, "all") == 0)
+					all_devices = 1;
+				else if (strcasecmp(name, "devices") == 0 && val)
+					device_paths = val;
+				else if (strcasecmp(name, "port") == 0 && val)
+					port_selector = val;
+				else if (strcasecmp(name, "serial") == 0 && val)
+					serial_selector = val;
+				else if (strcasecmp(name, "daemon") == 0 && val)
+					daemon_socket = val;
+				else if (strcasecmp(name, "connect") == 0 && val)
+					connect_socket = val;
+				else if (strcasecmp(name, "manifest") == 0 && val)
+					manifest_file = val;
+				else if (strcasecmp(name, "results") == 0 && val)
+					results_file = val;
+				else if (strcasecmp(name, "stats") == 0 && val)
+					stats_file = val;
+				else if (strcasecmp(name, "trace") == 0 && val)
+					trace_file_name = val;
+				else if (strcasecmp(name, "record") == 0 && val)
+					record_file_name = val;
+				else if (strcasecmp(name, "replay") == 0 && val)
+					replay_file_name = val;
 				else {
 					fprintf(stderr, "Unknown option \"%s\"\n\n", arg);
 					usage(NULL);
 				}
-			} else
+			} else if (arg[1])
 				parse_flag(arg);
+			else
+				add_input_file(arg); // "-", standard input
 		} else
-			filename = arg;
+			add_input_file(arg);
 	}
 }
 
-void boot(unsigned char* buf, int write_size)
+// writes s as a JSON string, or null
+void json_print(FILE* out, const char* s)
 {
-	printf_verbose("Booting\n");
-	memset(buf, 0, write_size);
-	buf[0] = 0xFF;
-	buf[1] = 0xFF;
-	buf[2] = 0xFF;
-	teensy_write(buf, write_size, 0.5);
+	if (!s) {
+		fputs("null", out);
+		return;
+	}
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(out, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, out);
+	}
+	fputc('"', out);
 }
 
 void usage(const char* err)
@@ -223,13 +311,32 @@ void usage(const char* err)
 	if (err != NULL)
 		fprintf(stderr, "%s\n\n", err);
 	fprintf(stderr,
-			"Usage: teensy_loader_cli --mcu=<MCU> [-w] [-h] [-n] [-b] [-v] <file.hex>\n"
+			"Usage: teensy_loader_cli --mcu=<MCU> [-w] [-h] [-n] [-b] [-v] <file.hex> [<file> ...]\n"
 			"\t-w : Wait for device to appear\n"
 			"\t-r : Use hard reboot if device not online\n"
 			"\t-s : Use soft reboot if device not online (Teensy 3.x & 4.x)\n"
 			"\t-n : No reboot after programming\n"
 			"\t-b : Boot only, do not program\n"
 			"\t-v : Verbose output\n"
+			"\t--threads=<n> : Threads used to parse large hex files (default: all CPUs)\n"
+			"\t--base-address=<addr> : Where a raw .bin file is written (default: 0)\n"
+			"\t--all : Program every HalfKay device at the same time\n"
+			"\t--devices=<path>[,<path>...] : Program these devices at the same time\n"
+			"\t--list-devices : List the paths of the HalfKay devices\n"
+			"\t--port=<path> : Only use the device on this USB port\n"
+			"\t--serial=<sn> : Only use the device with this serial number\n"
+			"\t--daemon=<socket> : Keep running and program the jobs sent to this socket\n"
+			"\t--connect=<socket> : Send this job to a daemon instead of running it\n"
+			"\t--manifest=<file> : Run the jobs listed in this file at the same time\n"
+			"\t--results=<file> : Write the JSON summary of --manifest here (default: stdout)\n"
+			"\t--stats=<file> : Write timings and transfer statistics as JSON\n"
+			"\t--trace=<file> : Write a Chrome trace of every USB write, reboot and device search\n"
+			"\t--record=<file> : Record every write to HalfKay, to be replayed later\n"
+			"\t--replay=<file> : Play back a recording instead of using USB (replay build only)\n"
+			"\nInstead of a hex file, a linked ELF32 file, a UF2 file or a raw .bin\n"
+			"file may be given. Several files are merged and written in one pass.\n"
+			"A file name of - reads the hex file from standard input, it is written\n"
+			"while it is still being read if its records are in address order.\n"
 			"\nUse `teensy_loader_cli --list-mcus` to list supported MCUs.\n"
 			"\nFor more information, please visit:\n"
 			"http://www.pjrc.com/teensy/loader_cli.html\n");
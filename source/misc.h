@@ -16,10 +16,21 @@
  * along with this program.  If not, see http://www.gnu.org/licenses/
  */
 
+#include <stdio.h>
+
+// for functions which never return
+#if defined(_MSC_VER)
+#define NORETURN __declspec(noreturn)
+#else
+#define NORETURN __attribute__((noreturn))
+#endif
+
 // Misc stuff
-int  printf_verbose(const char* format, ...);
-void delay(double seconds);
-void die(const char* str, ...);
-void parse_options(int argc, char** argv);
-void boot(unsigned char* buf, int write_size);
-void usage(const char* err);
+int    printf_verbose(const char* format, ...);
+void   delay(double seconds);
+double monotonic_time(void);
+NORETURN void die(const char* str, ...);
+void   json_print(FILE* out, const char* s);
+int    find_mcu(const char* name, int* code_size, int* block_size);
+void   parse_options(int argc, char** argv);
+void   usage(const char* err);
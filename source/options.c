@@ -0,0 +1,56 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <stddef.h>
+#include "ihex.h"
+#include "param.h"
+
+/****************************************************************/
+/*                                                              */
+/*                          Options                             */
+/*                                                              */
+/*  Set from the command line by parse_options(). Kept apart    */
+/*  from main.c so the benchmark programs can link them too.    */
+/*                                                              */
+/****************************************************************/
+
+int         wait_for_device_to_appear = 0;
+int         hard_reboot_device        = 0;
+int         soft_reboot_device        = 0;
+int         reboot_after_programming  = 1;
+int         verbose                   = 0;
+int         boot_only                 = 0;
+int         code_size = 0, block_size = 0;
+int         parse_threads             = 0;
+unsigned    base_address              = 0;
+int         list_devices              = 0;
+int         all_devices               = 0;
+const char* device_paths              = NULL;
+const char* port_selector             = NULL;
+const char* serial_selector           = NULL;
+const char* daemon_socket             = NULL;
+const char* connect_socket            = NULL;
+const char* manifest_file             = NULL;
+const char* results_file              = "-";
+const char* stats_file                = NULL;
+const char* trace_file_name           = NULL;
+const char* record_file_name          = NULL;
+const char* replay_file_name          = NULL;
+const char* filename                  = NULL;
+const char* input_files[MAX_INPUT_FILES];
+int         input_count               = 0;
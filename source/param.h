@@ -24,4 +24,21 @@ extern int verbose;
 extern int boot_only;
 extern int code_size;
 extern int block_size;
+extern int parse_threads;
+extern unsigned base_address;
+extern int list_devices;
+extern int all_devices;
+extern const char *device_paths;
+extern const char *port_selector;
+extern const char *serial_selector;
+extern const char *daemon_socket;
+extern const char *connect_socket;
+extern const char *manifest_file;
+extern const char *results_file;
+extern const char *stats_file;
+extern const char *trace_file_name;
+extern const char *record_file_name;
+extern const char *replay_file_name;
 extern const char *filename;
+extern const char *input_files[];
+extern int input_count;
@@ -0,0 +1,373 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "program.h"
+#include <stdio.h>
+#include <string.h>
+#include "dev.h"
+#include "ihex.h"
+#include "image.h"
+#include "misc.h"
+#include "param.h"
+#include "record.h"
+#include "stats.h"
+#include "trace.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/****************************************************************/
+/*                                                              */
+/*                     Programming Functions                    */
+/*                                                              */
+/****************************************************************/
+
+// size of the HalfKay report for the block size
+int program_write_size(int block_size)
+{
+	if (block_size == 512 || block_size == 1024)
+		return block_size + 64;
+	return block_size + 2;
+}
+
+// writes one report, adding it to the stats, the trace and the
+// recording. addr is -1 for the boot request
+static int write_block(struct teensy_device* dev, enum stats_phase phase, int addr, unsigned char* buf, int size, double timeout)
+{
+	const char* name    = phase == STATS_ERASE ? "erase" : phase == STATS_BOOT ? "boot" : "write";
+	long long   retries = stats_thread_retries();
+	double      begin   = stats_begin();
+	double      end;
+	long long   attempts;
+	char        block[16];
+	int         r;
+
+	r        = teensy_write_device(dev, buf, size, timeout);
+	end      = monotonic_time();
+	attempts = stats_thread_retries() - retries + r;
+	if (attempts < 1)
+		attempts = 1; // gave up on the first try
+	stats_record(phase, begin, end);
+	record_write(dev, buf, size, timeout, end - begin, r, (int)attempts, teensy_write_error());
+	if (!trace_enabled())
+		return r;
+	if (addr >= 0)
+		snprintf(block, sizeof(block), "\"0x%06X\"", addr);
+	else
+		strcpy(block, "null");
+	trace_event("usb", name, begin, end, "\"addr\": %s, \"size\": %d, \"attempts\": %lld, \"result\": \"%s\"", block, size, attempts, r ? "ok" : teensy_error_name(teensy_write_error()));
+	return r;
+}
+
+// How long HalfKay may take, per MCU family. The chip is erased while
+// the first few blocks arrive, which takes longer the more flash there
+// is to erase. The Teensy 4 external flash is only erased as far as the
+// image reaches. The erase times are estimates, so the deadline is
+// ERASE_MARGIN times the modeled erase plus ERASE_SLACK, and only MCUs
+// missing here get the 45 seconds the loader always allowed. Once an
+// erase was measured in this run, later images of the family that erase
+// no more flash get BLOCK_MARGIN times that if it's shorter.
+static const struct {
+	int    block_size;
+	int    code_size; // smallest flash of the family
+	double erase_time;
+	double erase_per_mb;
+	int    erase_image; // erase time follows the image, not the flash
+} models[] = {
+	{128, 0, 0.05, 0.0, 0},        // AVR, Teensy 2.0
+	{256, 0, 0.10, 0.0, 0},        // AVR, Teensy++ 2.0
+	{512, 0, 0.10, 0.0, 0},        // Kinetis L, Teensy LC
+	{1024, 0, 0.50, 2.0, 0},       // Kinetis K, Teensy 3.x
+	{1024, 2031616, 0.50, 4.0, 1}, // IMXRT, Teensy 4.x
+};
+
+#define MODEL_COUNT   (int)(sizeof(models) / sizeof(models[0]))
+#define ERASE_MARGIN  3.0 // times the modeled erase
+#define ERASE_SLACK   3.0 // seconds on top of that, for USB and the host
+#define ERASE_BLOCKS  5   // blocks HalfKay may stall on while erasing
+#define BLOCK_TIMEOUT 0.5 // least time allowed for any other block
+#define BLOCK_MARGIN  4.0 // times the slowest block or erase seen so far
+
+// slowest erase of each family measured in this run, and how much flash
+// it erased. Devices programmed at the same time share it.
+static struct {
+	double time;
+	double size;
+} measured[MODEL_COUNT];
+
+#if defined(WIN32)
+static SRWLOCK measured_lock = SRWLOCK_INIT;
+#define lock()   AcquireSRWLockExclusive(&measured_lock)
+#define unlock() ReleaseSRWLockExclusive(&measured_lock)
+#else
+static pthread_mutex_t measured_lock = PTHREAD_MUTEX_INITIALIZER;
+#define lock()   pthread_mutex_lock(&measured_lock)
+#define unlock() pthread_mutex_unlock(&measured_lock)
+#endif
+
+struct write_timeouts {
+	int    model;       // index into models[], -1 if the MCU isn't there
+	int    measure;     // the erase ran without the device dropping out
+	double erase_size;  // bytes of flash erased
+	double erase;       // for the whole erase, from the first block on
+	double erase_begin; // when the first block was sent
+	double erase_end;   // when the erase should be done
+	double slowest;     // slowest block after the erase
+};
+
+// the end of the last page of the image, 0 if it is empty
+static uint32_t image_end(const struct image* img)
+{
+	if (img->page_count == 0)
+		return 0;
+	return img->pages[img->page_count - 1]->addr + IMAGE_PAGE_SIZE;
+}
+
+static void init_timeouts(struct write_timeouts* t, const struct program_target* target)
+{
+	int i;
+
+	t->model       = -1;
+	t->measure     = 1;
+	t->erase_size  = target->code_size;
+	t->erase       = 45.0; // unknown MCUs keep the time that always worked
+	t->erase_begin = 0.0;
+	t->erase_end   = 0.0;
+	t->slowest     = 0.0;
+	for (i = 0; i < MODEL_COUNT; i++) {
+		if (models[i].block_size == target->block_size && models[i].code_size <= target->code_size)
+			t->model = i;
+	}
+	if (t->model < 0)
+		return;
+	i = t->model;
+	// a streamed image's end isn't known yet
+	if (models[i].erase_image && !target->stream && image_end(target->img) < (uint32_t)target->code_size)
+		t->erase_size = image_end(target->img);
+	t->erase = ERASE_MARGIN * (models[i].erase_time + models[i].erase_per_mb * t->erase_size / 1048576.0) + ERASE_SLACK;
+	lock();
+	if (measured[i].time > 0.0 && t->erase_size <= measured[i].size && BLOCK_MARGIN * measured[i].time < t->erase)
+		t->erase = BLOCK_MARGIN * measured[i].time;
+	unlock();
+}
+
+// remembers how long the erase took, for the next image of the family
+static void erase_done(struct write_timeouts* t)
+{
+	double time = monotonic_time() - t->erase_begin;
+
+	if (t->model < 0 || !t->measure)
+		return;
+	// erasing more flash doesn't get faster, so the slowest time holds
+	// for the most flash erased
+	lock();
+	if (time > measured[t->model].time)
+		measured[t->model].time = time;
+	if (t->erase_size > measured[t->model].size)
+		measured[t->model].size = t->erase_size;
+	unlock();
+}
+
+// the erase shares one deadline over the first blocks, so a device that
+// stopped answering gives up once the erase should have been done. Later
+// blocks get a multiple of the slowest block measured so far
+static double block_timeout(struct write_timeouts* t, int block_count)
+{
+	double now = monotonic_time();
+
+	if (block_count == 0) {
+		t->erase_begin = now;
+		t->erase_end   = now + t->erase;
+	}
+	if (block_count < ERASE_BLOCKS && t->erase_end - now > BLOCK_TIMEOUT)
+		return t->erase_end - now;
+	if (BLOCK_MARGIN * t->slowest > BLOCK_TIMEOUT)
+		return BLOCK_MARGIN * t->slowest;
+	return BLOCK_TIMEOUT;
+}
+
+// streamed images are only read where they are complete, which may
+// mean waiting for more input. A block of input that failed to parse
+// must never be written, its erase is already done
+static void get_data(const struct program_target* target, uint32_t addr, unsigned char* buf)
+{
+	if (!target->stream) {
+		image_get_data(target->img, addr, target->block_size, buf);
+		return;
+	}
+	if (!ihex_stream_wait(addr + target->block_size))
+		die("Error reading intel hex from standard input\n");
+	ihex_stream_get_data(addr, target->block_size, buf);
+}
+
+static int next_block(const struct program_target* target, uint32_t addr, uint32_t* next)
+{
+	if (target->stream)
+		return ihex_stream_next_block(addr, target->block_size, next);
+	return image_next_block(target->img, addr, target->block_size, next);
+}
+
+// how far programming got. addr is the first block the device hasn't
+// acknowledged, blocks counts the ones it has, so the erase is only
+// sent while blocks is 0
+struct write_state {
+	struct write_timeouts timeouts;
+	int                   addr;
+	int                   blocks;
+};
+
+// writes every non-blank block of the image from state->addr on, prints
+// a dot for each block if progress is set. Returns 0 if the device
+// stopped accepting data
+static int write_image(struct teensy_device* dev, const struct program_target* target, struct write_state* state, int progress)
+{
+	unsigned char buf[2048];
+	uint32_t      next;
+	double        begin;
+	int           addr, write_size;
+	int           code_size  = target->code_size;
+	int           block_size = target->block_size;
+
+	// always do the first block to erase the chip, after that only
+	// visit the blocks which hold data, blank or unused ones are skipped
+	for (addr = state->addr; addr < code_size;) {
+		if (progress)
+			printf_verbose(".");
+		if (block_size <= 256 && code_size < 0x10000) {
+			buf[0] = addr & 255;
+			buf[1] = (addr >> 8) & 255;
+			get_data(target, addr, buf + 2);
+			write_size = block_size + 2;
+		} else if (block_size == 256) {
+			buf[0] = (addr >> 8) & 255;
+			buf[1] = (addr >> 16) & 255;
+			get_data(target, addr, buf + 2);
+			write_size = block_size + 2;
+		} else if (block_size == 512 || block_size == 1024) {
+			buf[0] = addr & 255;
+			buf[1] = (addr >> 8) & 255;
+			buf[2] = (addr >> 16) & 255;
+			memset(buf + 3, 0, 61);
+			get_data(target, addr, buf + 64);
+			write_size = block_size + 64;
+		} else {
+			die("Unknown code/block size\n");
+		}
+		begin = monotonic_time();
+		if (!write_block(dev, state->blocks == 0 ? STATS_ERASE : STATS_WRITE, addr, buf, write_size, block_timeout(&state->timeouts, state->blocks))) {
+			state->timeouts.measure = 0; // the erase time includes the failure
+			return 0;
+		}
+		if (state->blocks >= ERASE_BLOCKS && monotonic_time() - begin > state->timeouts.slowest)
+			state->timeouts.slowest = monotonic_time() - begin;
+		stats_add(STATS_BYTES_SENT, write_size);
+		stats_add(STATS_BLOCKS_WRITTEN, 1);
+		state->blocks = state->blocks + 1;
+		if (state->blocks == ERASE_BLOCKS)
+			erase_done(&state->timeouts);
+		if (!next_block(target, addr + block_size, &next) || next >= (uint32_t)code_size)
+			next = code_size;
+		stats_add(STATS_BLOCKS_SKIPPED, (next - addr - 1) / block_size);
+		addr        = (int)next;
+		state->addr = addr;
+	}
+	if (state->blocks < ERASE_BLOCKS)
+		erase_done(&state->timeouts); // the image ended during the erase
+	if (progress)
+		printf_verbose("\n");
+	return 1;
+}
+
+static void init_state(struct write_state* state, const struct program_target* target)
+{
+	init_timeouts(&state->timeouts, target);
+	state->addr   = 0;
+	state->blocks = 0;
+}
+
+int program_image(struct teensy_device* dev, const struct program_target* target, int progress)
+{
+	struct write_state state;
+
+	init_state(&state, target);
+	if (!write_image(dev, target, &state, progress))
+		return -1;
+	return state.blocks;
+}
+
+#define RESUME_COUNT 3   // times a device may drop out during one image
+#define RESUME_WAIT  2.0 // seconds it may take to come back
+
+int program_resume(struct teensy_device** dev, const struct teensy_info* info, const struct program_target* target, int progress)
+{
+	struct teensy_device* reopened;
+	struct write_state    state;
+	int                   resumes;
+
+	init_state(&state, target);
+	for (resumes = 0; !write_image(*dev, target, &state, progress); resumes++) {
+		if (progress)
+			printf_verbose("\n");
+		if (resumes >= RESUME_COUNT)
+			return -1;
+		printf_verbose("Write failed (%s), reopening\n", teensy_error_name(teensy_write_error()));
+		reopened = teensy_reopen(*dev, info, RESUME_WAIT);
+		*dev     = reopened;
+		if (!reopened)
+			return -1;
+		stats_add(STATS_RESUMES, 1);
+		if (state.blocks)
+			printf_verbose("Resuming at 0x%06X%s", state.addr, progress ? "" : "\n");
+		else
+			printf_verbose("Restarting%s", progress ? "" : "\n");
+	}
+	return state.blocks;
+}
+
+int program_device(struct teensy_device** dev, const struct teensy_info* info, int progress)
+{
+	struct program_target target = {
+		.img        = ihex_image(),
+		.code_size  = code_size,
+		.block_size = block_size,
+	};
+
+	return program_resume(dev, info, &target, progress);
+}
+
+// reboots the device to the user's code
+int boot_block_size(struct teensy_device* dev, int block_size)
+{
+	unsigned char buf[2048];
+	int           write_size = program_write_size(block_size);
+
+	printf_verbose("Booting\n");
+	memset(buf, 0, write_size);
+	buf[0] = 0xFF;
+	buf[1] = 0xFF;
+	buf[2] = 0xFF;
+	return write_block(dev, STATS_BOOT, -1, buf, write_size, 0.5);
+}
+
+int boot(struct teensy_device* dev)
+{
+	return boot_block_size(dev, block_size);
+}
@@ -0,0 +1,48 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+struct image;
+struct teensy_device;
+struct teensy_info;
+
+// A parsed image and the MCU it is written to. Images are only read
+// from, so different devices may be programmed from different threads
+// at the same time, with the same or different images.
+struct program_target {
+	const struct image* img;
+	int                 code_size;
+	int                 block_size;
+	int                 stream; // img is still read by read_intel_hex_stream()
+};
+
+// Programming Functions
+// program_device() and boot() use the image read by read_intel_hex()
+// and the MCU given on the command line.
+int program_write_size(int block_size);
+int program_image(struct teensy_device* dev, const struct program_target* target, int progress);
+
+// Like program_image(), but if the device drops out part way and comes
+// back still running HalfKay, it's reopened with teensy_reopen() and
+// programming carries on from the first block it didn't acknowledge,
+// without sending the erase again. info is the device's, so no other
+// board is mistaken for it. *dev is updated to the reopened device,
+// NULL if it couldn't be reopened.
+int program_resume(struct teensy_device** dev, const struct teensy_info* info, const struct program_target* target, int progress);
+int program_device(struct teensy_device** dev, const struct teensy_info* info, int progress);
+int boot_block_size(struct teensy_device* dev, int block_size);
+int boot(struct teensy_device* dev);
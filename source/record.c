@@ -0,0 +1,167 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "record.h"
+#include <stdio.h>
+#include <string.h>
+#include "dev.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/****************************************************************/
+/*                                                              */
+/*                      Recording Functions                     */
+/*                                                              */
+/****************************************************************/
+
+#define RECORD_MAX_DEVICES 64
+
+struct recorded_device {
+	const struct teensy_device* dev;  // the handle it is written with now
+	struct teensy_info          info; // empty if the device wasn't named
+};
+
+static FILE*                  record_file = NULL;
+static struct recorded_device record_devices[RECORD_MAX_DEVICES];
+static int                    record_device_count = 0;
+
+#if defined(WIN32)
+static SRWLOCK record_lock = SRWLOCK_INIT;
+#define lock()   AcquireSRWLockExclusive(&record_lock)
+#define unlock() ReleaseSRWLockExclusive(&record_lock)
+#else
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+#define lock()   pthread_mutex_lock(&record_lock)
+#define unlock() pthread_mutex_unlock(&record_lock)
+#endif
+
+int record_open(const char* filename)
+{
+	unsigned char header[RECORD_HEADER_SIZE] = RECORD_MAGIC;
+
+	record_file = fopen(filename, "wb");
+	if (!record_file)
+		return 0;
+	header[5] = RECORD_VERSION;
+	fwrite(header, 1, sizeof(header), record_file);
+	return 1;
+}
+
+void record_close(void)
+{
+	lock();
+	if (record_file) {
+		fclose(record_file);
+		record_file = NULL;
+	}
+	unlock();
+}
+
+static void put16(unsigned char* p, unsigned int n)
+{
+	p[0] = n & 255;
+	p[1] = (n >> 8) & 255;
+}
+
+static void put32(unsigned char* p, unsigned long n)
+{
+	put16(p, n & 0xFFFF);
+	put16(p + 2, (n >> 16) & 0xFFFF);
+}
+
+// the same board, also after it came back on a new path
+static int same_device(const struct teensy_info* a, const struct teensy_info* b)
+{
+	if (a->path[0] && strcmp(a->path, b->path) == 0)
+		return 1;
+	return a->serial[0] && strcmp(a->serial, b->serial) == 0;
+}
+
+void record_device(const struct teensy_device* dev, const struct teensy_info* info)
+{
+	int i, found = -1;
+
+	if (!record_file)
+		return;
+	lock();
+	for (i = 0; i < record_device_count; i++) {
+		if (found < 0 && same_device(&record_devices[i].info, info))
+			found = i;
+		else if (record_devices[i].dev == dev)
+			record_devices[i].dev = NULL; // a closed device's handle, reused
+	}
+	if (found < 0 && record_device_count < RECORD_MAX_DEVICES)
+		found = record_device_count++;
+	if (found >= 0) {
+		record_devices[found].dev  = dev;
+		record_devices[found].info = *info;
+	}
+	unlock();
+}
+
+// devices are told apart by the handle they are written with now,
+// call with the lock held
+static int device_number(const struct teensy_device* dev)
+{
+	int i;
+
+	for (i = 0; i < record_device_count; i++) {
+		if (record_devices[i].dev == dev)
+			return i;
+	}
+	if (record_device_count < RECORD_MAX_DEVICES) {
+		memset(&record_devices[i], 0, sizeof(record_devices[0]));
+		record_devices[record_device_count++].dev = dev;
+	}
+	return i;
+}
+
+static unsigned long microseconds(double seconds)
+{
+	if (seconds <= 0.0)
+		return 0;
+	if (seconds >= 4294.0)
+		return 0xFFFFFFFFUL;
+	return (unsigned long)(seconds * 1000000.0);
+}
+
+void record_write(const struct teensy_device* dev, const void* buf, int len, double timeout, double seconds, int result, int attempts, int error)
+{
+	unsigned char entry[RECORD_ENTRY_SIZE];
+
+	if (!record_file)
+		return;
+	lock();
+	if (record_file) {
+		put16(entry, device_number(dev));
+		put16(entry + 2, len);
+		put32(entry + 4, microseconds(timeout));
+		put32(entry + 8, microseconds(seconds));
+		entry[12] = result ? 1 : 0;
+		entry[13] = attempts > 255 ? 255 : attempts;
+		entry[14] = result ? 0 : error;
+		entry[15] = 0;
+		fwrite(entry, 1, sizeof(entry), record_file);
+		fwrite(buf, 1, len, record_file);
+	}
+	unlock();
+}
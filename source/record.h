@@ -0,0 +1,50 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+struct teensy_device;
+struct teensy_info;
+
+// A recording is "TLREC" and a version byte, padded to 8 bytes, then
+// one entry per write to HalfKay, all numbers little endian:
+//   u16 device     numbered in the order devices are opened, or first
+//                  written to if they weren't opened by name. A device
+//                  that is reopened keeps its number
+//   u16 length     of the report
+//   u32 timeout    given to teensy_write_device(), in microseconds
+//   u32 latency    how long the write took, in microseconds
+//   u8  result     1 if the device accepted the report
+//   u8  attempts   including retries, at most 255
+//   u8  error      enum teensy_error of a failed write, else 0
+//   u8  reserved   0
+//   the report itself
+// Version 1 entries end after attempts, their failures timed out.
+#define RECORD_MAGIC         "TLREC"
+#define RECORD_VERSION       2
+#define RECORD_HEADER_SIZE   8
+#define RECORD_ENTRY_SIZE    16
+#define RECORD_V1_ENTRY_SIZE 14
+
+// Recording Functions
+// Safe to call from any thread, record_write() does nothing until
+// record_open(). record_device() names the device written to with dev,
+// by its path or serial number, so a reopened handle of the same device
+// is recorded under the same number.
+int  record_open(const char* filename);
+void record_close(void);
+void record_device(const struct teensy_device* dev, const struct teensy_info* info);
+void record_write(const struct teensy_device* dev, const void* buf, int len, double timeout, double seconds, int result, int attempts, int error);
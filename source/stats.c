@@ -0,0 +1,164 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+#include "misc.h"
+#include "thread.h"
+#include "trace.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#endif
+
+/****************************************************************/
+/*                                                              */
+/*                     Statistics Functions                     */
+/*                                                              */
+/****************************************************************/
+
+static const char* phase_names[STATS_PHASES] = {
+	"parse",
+	"enumerate",
+	"reboot",
+	"wait",
+	"erase",
+	"write",
+	"boot",
+};
+
+static const char* counter_names[STATS_COUNTERS] = {
+	"bytes_sent",
+	"blocks_written",
+	"blocks_skipped",
+	"retries",
+	"resumes",
+};
+
+// times are kept in microseconds, so they can be added up atomically
+static struct {
+	long long first; // start of the first occurrence + 1, 0 if none yet
+	long long total;
+	long long count;
+} phases[STATS_PHASES];
+
+static long long              counters[STATS_COUNTERS];
+static double                 start_time     = 0.0;
+static THREAD_LOCAL long long thread_retries = 0;
+
+static void atomic_add(long long* p, long long n)
+{
+#if defined(WIN32)
+	InterlockedExchangeAdd64((volatile LONG64*)p, n);
+#else
+	__atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+#endif
+}
+
+// stores value if *p is still 0
+static void atomic_set_once(long long* p, long long value)
+{
+#if defined(WIN32)
+	InterlockedCompareExchange64((volatile LONG64*)p, value, 0);
+#else
+	long long expected = 0;
+
+	__atomic_compare_exchange_n(p, &expected, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+#endif
+}
+
+static long long load(const long long* p)
+{
+#if defined(WIN32)
+	return InterlockedCompareExchange64((volatile LONG64*)p, 0, 0);
+#else
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+#endif
+}
+
+// every time in the report is relative to this
+void stats_start(void)
+{
+	start_time = monotonic_time();
+}
+
+double stats_begin(void)
+{
+	return monotonic_time();
+}
+
+void stats_end(enum stats_phase phase, double begin)
+{
+	double now = monotonic_time();
+
+	stats_record(phase, begin, now);
+	trace_event("phase", phase_names[phase], begin, now, NULL);
+}
+
+void stats_record(enum stats_phase phase, double begin, double end)
+{
+	atomic_set_once(&phases[phase].first, (long long)((begin - start_time) * 1000000.0) + 1);
+	atomic_add(&phases[phase].total, (long long)((end - begin) * 1000000.0));
+	atomic_add(&phases[phase].count, 1);
+}
+
+void stats_add(enum stats_counter counter, long long n)
+{
+	atomic_add(&counters[counter], n);
+	if (counter == STATS_RETRIES)
+		thread_retries += n;
+}
+
+// retries counted by the calling thread, the difference over a write
+// is how many times it was retried
+long long stats_thread_retries(void)
+{
+	return thread_retries;
+}
+
+int stats_write(const char* filename)
+{
+	FILE*     out;
+	long long first;
+	double    transfer;
+	int       i;
+
+	out = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+	if (!out)
+		return 0;
+	fprintf(out, "{\n\t\"seconds\": %.6f,\n\t\"phases\": {\n", monotonic_time() - start_time);
+	for (i = 0; i < STATS_PHASES; i++) {
+		first = load(&phases[i].first);
+		fprintf(out, "\t\t\"%s\": {\"start\": ", phase_names[i]);
+		if (first)
+			fprintf(out, "%.6f", (double)(first - 1) / 1000000.0);
+		else
+			fprintf(out, "null");
+		fprintf(out, ", \"seconds\": %.6f, \"count\": %lld}%s\n", (double)load(&phases[i].total) / 1000000.0, load(&phases[i].count), i + 1 < STATS_PHASES ? "," : "");
+	}
+	fprintf(out, "\t},\n");
+	for (i = 0; i < STATS_COUNTERS; i++)
+		fprintf(out, "\t\"%s\": %lld,\n", counter_names[i], load(&counters[i]));
+	// erase and write together are the time spent sending the image
+	transfer = (double)(load(&phases[STATS_ERASE].total) + load(&phases[STATS_WRITE].total)) / 1000000.0;
+	fprintf(out, "\t\"kb_per_second\": %.3f\n}\n", transfer > 0.0 ? (double)load(&counters[STATS_BYTES_SENT]) / 1024.0 / transfer : 0.0);
+	if (out != stdout)
+		fclose(out);
+	return 1;
+}
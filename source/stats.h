@@ -0,0 +1,51 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+// Phases of a run. The time of every phase is added up over all
+// devices, so with several devices it can exceed the wall time.
+enum stats_phase {
+	STATS_PARSE,     // reading the hex file
+	STATS_ENUMERATE, // looking for devices
+	STATS_REBOOT,    // hard or soft reboot requests
+	STATS_WAIT,      // waiting for the bootloader to appear
+	STATS_ERASE,     // the first block, HalfKay erases the chip
+	STATS_WRITE,     // every other block
+	STATS_BOOT,      // rebooting into the new code
+	STATS_PHASES
+};
+
+enum stats_counter {
+	STATS_BYTES_SENT,     // report bytes accepted by the devices
+	STATS_BLOCKS_WRITTEN, // reports accepted by the devices
+	STATS_BLOCKS_SKIPPED, // blank blocks which weren't sent
+	STATS_RETRIES,        // writes the device didn't accept right away
+	STATS_RESUMES,        // times programming carried on after reopening
+	STATS_COUNTERS
+};
+
+// Statistics Functions
+// Safe to call from any thread. stats_write() writes a JSON report.
+// stats_end() also adds the phase to the trace, stats_record() leaves
+// that to the caller.
+void      stats_start(void);
+double    stats_begin(void);
+void      stats_end(enum stats_phase phase, double begin);
+void      stats_record(enum stats_phase phase, double begin, double end);
+void      stats_add(enum stats_counter counter, long long n);
+long long stats_thread_retries(void);
+int       stats_write(const char* filename);
@@ -0,0 +1,125 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "thread.h"
+#include <stdlib.h>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/****************************************************************/
+/*                                                              */
+/*                           Threads                            */
+/*                                                              */
+/****************************************************************/
+
+struct thread {
+#if defined(WIN32)
+	HANDLE        handle;
+	volatile LONG done;
+#else
+	pthread_t handle;
+	int       done;
+#endif
+	void (*func)(void* arg);
+	void* arg;
+};
+
+#if defined(WIN32)
+static DWORD WINAPI thread_main(LPVOID param)
+#else
+static void* thread_main(void* param)
+#endif
+{
+	struct thread* thread = param;
+
+	thread->func(thread->arg);
+#if defined(WIN32)
+	InterlockedExchange(&thread->done, 1);
+#else
+	__atomic_store_n(&thread->done, 1, __ATOMIC_RELEASE);
+#endif
+	return 0;
+}
+
+struct thread* thread_start(void (*func)(void* arg), void* arg)
+{
+	struct thread* thread;
+
+	thread = malloc(sizeof(*thread));
+	if (thread != NULL) {
+		thread->func = func;
+		thread->arg  = arg;
+		thread->done = 0;
+#if defined(WIN32)
+		thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL);
+		if (thread->handle != NULL)
+			return thread;
+#else
+		if (pthread_create(&thread->handle, NULL, thread_main, thread) == 0)
+			return thread;
+#endif
+		free(thread);
+	}
+	func(arg);
+	return NULL;
+}
+
+void thread_join(struct thread* thread)
+{
+	if (thread == NULL)
+		return;
+#if defined(WIN32)
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+	free(thread);
+}
+
+/* returns 1 once the thread function has returned, so thread_join() */
+/* won't block */
+int thread_finished(struct thread* thread)
+{
+	if (thread == NULL)
+		return 1;
+#if defined(WIN32)
+	return InterlockedCompareExchange(&thread->done, 0, 0) != 0;
+#else
+	return __atomic_load_n(&thread->done, __ATOMIC_ACQUIRE) != 0;
+#endif
+}
+
+int thread_cpu_count(void)
+{
+#if defined(WIN32)
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int)n : 1;
+#endif
+}
@@ -0,0 +1,33 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+// Thread Functions
+// If a thread can't be created, thread_start() runs func right away
+// on the calling thread and returns NULL, thread_join(NULL) does nothing.
+struct thread;
+struct thread* thread_start(void (*func)(void* arg), void* arg);
+void           thread_join(struct thread* thread);
+int            thread_finished(struct thread* thread);
+int            thread_cpu_count(void);
+
+// storage class for variables with one copy per thread
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
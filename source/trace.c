@@ -0,0 +1,138 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "trace.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "misc.h"
+#include "thread.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/****************************************************************/
+/*                                                              */
+/*                       Trace Functions                        */
+/*                                                              */
+/****************************************************************/
+
+// events are written as they happen, in the JSON array form of the
+// format, which viewers also read without the closing bracket. So the
+// trace of a run which hangs or is killed is still usable
+static FILE*            trace_file  = NULL;
+static double           trace_start = 0.0;
+static int              event_count = 0;
+static int              thread_ids  = 0;
+static THREAD_LOCAL int thread_id   = 0;
+
+#if defined(WIN32)
+static SRWLOCK trace_lock = SRWLOCK_INIT;
+#define lock()   AcquireSRWLockExclusive(&trace_lock)
+#define unlock() ReleaseSRWLockExclusive(&trace_lock)
+#else
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#define lock()   pthread_mutex_lock(&trace_lock)
+#define unlock() pthread_mutex_unlock(&trace_lock)
+#endif
+
+int trace_open(const char* filename)
+{
+	trace_file = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+	if (!trace_file)
+		return 0;
+	trace_start = monotonic_time();
+	fprintf(trace_file, "[");
+	trace_thread_name("main");
+	return 1;
+}
+
+void trace_close(void)
+{
+	lock();
+	if (trace_file) {
+		fprintf(trace_file, "\n]\n");
+		if (trace_file != stdout)
+			fclose(trace_file);
+		trace_file = NULL;
+	}
+	unlock();
+}
+
+int trace_enabled(void)
+{
+	return trace_file != NULL;
+}
+
+// numbers threads in the order they first trace something, call with
+// the lock held
+static int current_thread(void)
+{
+	if (!thread_id)
+		thread_id = ++thread_ids;
+	return thread_id;
+}
+
+// starts an event, call with the lock held
+static void begin_event(void)
+{
+	fprintf(trace_file, "%s\n{", event_count++ ? "," : "");
+}
+
+// labels the calling thread's row in the timeline
+void trace_thread_name(const char* name)
+{
+	if (!trace_file)
+		return;
+	lock();
+	if (trace_file) {
+		begin_event();
+		fprintf(trace_file, "\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ", current_thread());
+		json_print(trace_file, name);
+		fprintf(trace_file, "}}");
+	}
+	unlock();
+}
+
+// records something which ran from begin to end, both from
+// monotonic_time(). args is a printf format for the members of the
+// event's args object, or NULL
+void trace_event(const char* category, const char* name, double begin, double end, const char* args, ...)
+{
+	va_list ap;
+
+	if (!trace_file)
+		return;
+	lock();
+	if (trace_file) {
+		begin_event();
+		fprintf(trace_file, "\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.1f, \"dur\": %.1f, \"pid\": 1, \"tid\": %d", name, category, (begin - trace_start) * 1000000.0, (end - begin) * 1000000.0, current_thread());
+		if (args) {
+			fprintf(trace_file, ", \"args\": {");
+			va_start(ap, args);
+			vfprintf(trace_file, args, ap);
+			va_end(ap);
+			fprintf(trace_file, "}");
+		}
+		fprintf(trace_file, "}");
+	}
+	unlock();
+}
@@ -0,0 +1,27 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+// Trace Functions
+// Writes a Chrome trace event file, which chrome://tracing and
+// ui.perfetto.dev can show as a timeline with one row per thread.
+// Safe to call from any thread, does nothing until trace_open().
+int  trace_open(const char* filename);
+void trace_close(void);
+int  trace_enabled(void);
+void trace_thread_name(const char* name);
+void trace_event(const char* category, const char* name, double begin, double end, const char* args, ...);
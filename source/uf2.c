@@ -0,0 +1,83 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "uf2.h"
+#include <stdint.h>
+#include <stdio.h>
+#include "ihex.h"
+#include "image.h"
+
+/****************************************************************/
+/*                                                              */
+/*                       Read UF2 Firmware                      */
+/*                                                              */
+/****************************************************************/
+
+// https://github.com/microsoft/uf2
+#define UF2_BLOCK_SIZE     512
+#define UF2_PAYLOAD_MAX    476
+#define UF2_MAGIC_START0   0x0A324655
+#define UF2_MAGIC_START1   0x9E5D5157
+#define UF2_MAGIC_END      0x0AB16F30
+#define UF2_NOT_MAIN_FLASH 0x00000001
+#define UF2_FILE_CONTAINER 0x00001000
+
+static uint32_t get32(const unsigned char* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int uf2_is_file(const char* data, size_t size)
+{
+	const unsigned char* block = (const unsigned char*)data;
+
+	return size >= UF2_BLOCK_SIZE && get32(block) == UF2_MAGIC_START0 && get32(block + 4) == UF2_MAGIC_START1;
+}
+
+/* Every block says where its payload goes, so the blocks are copied */
+/* straight from the file without looking at the order or the block */
+/* numbers. Addresses go through the same FlexSPI mapping as hex files. */
+int read_uf2_data(const char* data, size_t size, struct image* img)
+{
+	const unsigned char* block;
+	uint32_t             flags, addr, len;
+	size_t               offset;
+	int                  bytes = 0;
+
+	if (size % UF2_BLOCK_SIZE) {
+		printf("Warning, UF2 file size is not a multiple of %d\n", UF2_BLOCK_SIZE);
+		return -2;
+	}
+	for (offset = 0; offset < size; offset += UF2_BLOCK_SIZE) {
+		block = (const unsigned char*)data + offset;
+		flags = get32(block + 8);
+		addr  = get32(block + 12);
+		len   = get32(block + 16);
+		if (get32(block) != UF2_MAGIC_START0 || get32(block + 4) != UF2_MAGIC_START1 || get32(block + 508) != UF2_MAGIC_END || len > UF2_PAYLOAD_MAX || (uint64_t)addr + len > 0x100000000ull) {
+			printf("Warning, UF2 block %d is damaged\n", (int)(offset / UF2_BLOCK_SIZE));
+			return -2;
+		}
+		if (flags & (UF2_NOT_MAIN_FLASH | UF2_FILE_CONTAINER))
+			continue;
+		addr = ihex_flash_addr(addr);
+		if (!image_write(img, addr, block + 32, (int)len))
+			return -2;
+		bytes += (int)len;
+	}
+	return bytes;
+}
@@ -0,0 +1,30 @@
+/* Teensy Loader, Command Line Interface
+ * Program and Reboot Teensy Board with HalfKay Bootloader
+ * http://www.pjrc.com/teensy/loader_cli.html
+ * Copyright 2008-2016, PJRC.COM, LLC
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <stddef.h>
+
+struct image;
+
+// UF2 Firmware Functions
+// uf2_is_file() tells UF2 files apart from hex by the magic numbers of
+// their first block. read_uf2_data() copies the payload of every
+// 512 byte block meant for the main flash into img at its target
+// address. Returns the number of bytes loaded, or -2 if a block is
+// damaged or the file doesn't end on a block.
+int uf2_is_file(const char* data, size_t size);
+int read_uf2_data(const char* data, size_t size, struct image* img);